@@ -0,0 +1,166 @@
+#ifndef SPLITTER_BLOB_FEED_HPP
+#define SPLITTER_BLOB_FEED_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <osmium/io/file.hpp>
+
+#include "pbf_index.hpp"
+
+/**
+ * Feeds some of the blobs of a PBF file to an osmium Reader, through a
+ * pipe the Reader opens as /dev/fd/N. A thread copies the header and the
+ * selected blobs into the pipe, runs of neighbouring blobs in one go,
+ * while the Reader decodes what already arrived.
+ *
+ * SIGPIPE has to be ignored, a Reader that stops early leaves the copy
+ * with EPIPE.
+ *
+ * The Reader turns every data blob into one buffer, so the buffers it
+ * returns belong to the blobs in blobs(), in that order, as long as none
+ * is empty.
+ */
+class blob_feed {
+
+    int m_input;
+    int m_pipe[2];
+    std::thread m_thread;
+
+    // byte ranges of the input to copy, in order
+    std::vector<std::pair<uint64_t, uint64_t>> m_ranges;
+
+    // the data blobs in those ranges
+    std::vector<pbf_index::blob> m_blobs;
+
+    void copy() {
+        std::vector<char> buffer(1024 * 1024);
+        for (const auto& range : m_ranges) {
+            uint64_t offset = range.first;
+            while (offset < range.second) {
+                const size_t want = std::min<uint64_t>(buffer.size(), range.second - offset);
+                const ssize_t got = pread(m_input, buffer.data(), want, offset);
+                if (got <= 0) {
+                    std::cerr << "error reading input for blob feed: " << strerror(errno) << "\n";
+                    close(m_pipe[1]);
+                    return;
+                }
+
+                ssize_t written = 0;
+                while (written < got) {
+                    const ssize_t n = write(m_pipe[1], buffer.data() + written, got - written);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        // the reader is gone, EPIPE
+                        close(m_pipe[1]);
+                        return;
+                    }
+                    written += n;
+                }
+                offset += got;
+            }
+        }
+        close(m_pipe[1]);
+    }
+
+public:
+
+    blob_feed() :
+        m_input(-1),
+        m_thread(),
+        m_ranges(),
+        m_blobs() {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+
+    ~blob_feed() {
+        // closing the read end makes a copy still blocked on it give up
+        if (m_pipe[0] >= 0) close(m_pipe[0]);
+        if (m_thread.joinable()) m_thread.join();
+        if (m_input >= 0) close(m_input);
+    }
+
+    /**
+     * start feeding the header blob of filename and the data blobs of
+     * index for which wanted(blob) returns true
+     */
+    template <typename TWanted>
+    bool open(const std::string& filename, const pbf_index& index, TWanted wanted) {
+        uint64_t total = 0;
+        uint64_t selected = 0;
+        for (const auto& blob : index.blobs()) {
+            total += blob.size;
+            if (blob.data && !wanted(blob)) {
+                continue;
+            }
+            selected += blob.size;
+            if (blob.data) {
+                m_blobs.push_back(blob);
+            }
+            if (!m_ranges.empty() && m_ranges.back().second == blob.offset) {
+                m_ranges.back().second += blob.size;
+            } else {
+                m_ranges.push_back(std::make_pair(blob.offset, blob.offset + blob.size));
+            }
+        }
+        std::cerr << "reading " << selected / (1024 * 1024) << " of " << total / (1024 * 1024) << " MB of " << filename << "\n";
+
+        m_input = ::open(filename.c_str(), O_RDONLY);
+        if (m_input < 0) {
+            std::cerr << "can't open " << filename << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        if (pipe(m_pipe) != 0) {
+            std::cerr << "can't create pipe for blob feed: " << strerror(errno) << "\n";
+            m_pipe[0] = m_pipe[1] = -1;
+            return false;
+        }
+
+        m_thread = std::thread(&blob_feed::copy, this);
+        return true;
+    }
+
+    /**
+     * the file to hand to the osmium Reader
+     */
+    osmium::io::File file() const {
+        return osmium::io::File("/dev/fd/" + std::to_string(m_pipe[0]), "pbf");
+    }
+
+    /**
+     * the data blobs fed, in order
+     */
+    const std::vector<pbf_index::blob>& blobs() const {
+        return m_blobs;
+    }
+
+    /**
+     * read blob as it is in the input, length and header included
+     */
+    bool read(const pbf_index::blob& blob, std::string& data) const {
+        data.resize(blob.size);
+        uint64_t done = 0;
+        while (done < blob.size) {
+            const ssize_t n = pread(m_input, &data[done], blob.size - done, blob.offset + done);
+            if (n <= 0) {
+                std::cerr << "error reading input blob: " << strerror(errno) << "\n";
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+}; // class blob_feed
+
+#endif // SPLITTER_BLOB_FEED_HPP
@@ -0,0 +1,106 @@
+#ifndef BLOCK_SUMMARY_HPP
+#define BLOCK_SUMMARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+/**
+ * One bit per block of 4096 object ids, set if any id of the block may be
+ * in a set. A planet needs a few hundred KB for it, small enough to stay
+ * in the cache, so an id in an empty block is turned down without
+ * touching the set itself.
+ *
+ * The trackers keep one to answer most get() calls that return false,
+ * and CutInfo keeps the union over all extracts to skip objects that are
+ * in no extract at all.
+ *
+ * Negative ids always count as possibly set.
+ */
+class block_summary {
+
+public:
+
+    static const size_t block_bits = 12;
+
+private:
+
+    std::vector<uint64_t> m_words;
+
+    static uint64_t block(const osmium::object_id_type id) {
+        return static_cast<uint64_t>(id) >> block_bits;
+    }
+
+public:
+
+    block_summary() :
+        m_words() {
+    }
+
+    void set(const osmium::object_id_type id) {
+        if (id < 0) return;
+        const uint64_t b = block(id);
+        if (b / 64 >= m_words.size()) {
+            m_words.resize(b / 64 + 1, 0);
+        }
+        m_words[b / 64] |= uint64_t(1) << (b % 64);
+    }
+
+    bool get(const osmium::object_id_type id) const {
+        if (id < 0) return true;
+        const uint64_t b = block(id);
+        return b / 64 < m_words.size() && ((m_words[b / 64] >> (b % 64)) & 1);
+    }
+
+    /**
+     * may any id in [first, last] be set?
+     */
+    bool any(const osmium::object_id_type first, const osmium::object_id_type last) const {
+        if (first > last) return false;
+        if (first < 0) return true;
+        const uint64_t first_block = block(first);
+        const uint64_t last_block = block(last);
+        for (uint64_t w = first_block / 64; w <= last_block / 64 && w < m_words.size(); w++) {
+            uint64_t word = m_words[w];
+            if (w == first_block / 64) {
+                word &= ~uint64_t(0) << (first_block % 64);
+            }
+            if (w == last_block / 64) {
+                word &= ~uint64_t(0) >> (63 - last_block % 64);
+            }
+            if (word) return true;
+        }
+        return false;
+    }
+
+    void clear() {
+        std::vector<uint64_t>().swap(m_words);
+    }
+
+    block_summary& operator|=(const block_summary& other) {
+        if (other.m_words.size() > m_words.size()) {
+            m_words.resize(other.m_words.size(), 0);
+        }
+        for (size_t w = 0; w < other.m_words.size(); w++) {
+            m_words[w] |= other.m_words[w];
+        }
+        return *this;
+    }
+
+    // the blocks of an intersection are at most the intersection of the
+    // blocks, a superset is all a summary has to be
+    block_summary& operator&=(const block_summary& other) {
+        if (m_words.size() > other.m_words.size()) {
+            m_words.resize(other.m_words.size());
+        }
+        for (size_t w = 0; w < m_words.size(); w++) {
+            m_words[w] &= other.m_words[w];
+        }
+        return *this;
+    }
+
+}; // class block_summary
+
+#endif // BLOCK_SUMMARY_HPP
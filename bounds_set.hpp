@@ -0,0 +1,118 @@
+#ifndef BOUNDS_SET_HPP
+#define BOUNDS_SET_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <osmium/osm/box.hpp>
+
+#include "cpu_features.hpp"
+
+/**
+ * A list of bounding boxes stored as separate arrays of their min and max
+ * coordinates, so one point can be tested against eight boxes at a time.
+ *
+ * A point is inside a box if it lies strictly between its edges, like
+ * ExtractInfo::contains() does for BOUNDS extracts.
+ */
+class bounds_set {
+
+    // the arrays are padded to a multiple of eight with boxes nothing is
+    // inside of, so the kernels never need a tail loop
+    static const size_t lanes = 8;
+
+    std::vector<int32_t> m_min_x;
+    std::vector<int32_t> m_min_y;
+    std::vector<int32_t> m_max_x;
+    std::vector<int32_t> m_max_y;
+
+    // extract number of every box
+    std::vector<uint32_t> m_extracts;
+
+    size_t m_count;
+
+    void find_scalar(int32_t x, int32_t y, std::vector<uint32_t>& hits) const {
+        for (size_t i = 0; i < m_count; i++) {
+            if (x > m_min_x[i] && y > m_min_y[i] && x < m_max_x[i] && y < m_max_y[i]) {
+                hits.push_back(m_extracts[i]);
+            }
+        }
+    }
+
+#ifdef SPLITTER_HAVE_X86_KERNELS
+    __attribute__((target("avx2")))
+    void find_avx2(int32_t x, int32_t y, std::vector<uint32_t>& hits) const {
+        const __m256i vx = _mm256_set1_epi32(x);
+        const __m256i vy = _mm256_set1_epi32(y);
+
+        for (size_t i = 0; i < m_count; i += lanes) {
+            const __m256i min_x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&m_min_x[i]));
+            const __m256i min_y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&m_min_y[i]));
+            const __m256i max_x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&m_max_x[i]));
+            const __m256i max_y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&m_max_y[i]));
+
+            const __m256i in = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi32(vx, min_x), _mm256_cmpgt_epi32(vy, min_y)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(max_x, vx), _mm256_cmpgt_epi32(max_y, vy)));
+
+            unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+            while (mask) {
+                hits.push_back(m_extracts[i + __builtin_ctz(mask)]);
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+public:
+
+    bounds_set() :
+        m_min_x(),
+        m_min_y(),
+        m_max_x(),
+        m_max_y(),
+        m_extracts(),
+        m_count(0) {
+    }
+
+    void add(const osmium::Box& box, uint32_t extract) {
+        if (m_count % lanes == 0) {
+            const size_t size = m_count + lanes;
+            m_min_x.resize(size, std::numeric_limits<int32_t>::max());
+            m_min_y.resize(size, std::numeric_limits<int32_t>::max());
+            m_max_x.resize(size, std::numeric_limits<int32_t>::min());
+            m_max_y.resize(size, std::numeric_limits<int32_t>::min());
+            m_extracts.resize(size, 0);
+        }
+
+        m_min_x[m_count] = box.bottom_left().x();
+        m_min_y[m_count] = box.bottom_left().y();
+        m_max_x[m_count] = box.top_right().x();
+        m_max_y[m_count] = box.top_right().y();
+        m_extracts[m_count] = extract;
+        m_count++;
+    }
+
+    size_t size() const {
+        return m_count;
+    }
+
+    /**
+     * append the extract numbers of all boxes the point given in osmium
+     * fixed point coordinates is inside of to hits, in the order they were
+     * added
+     */
+    void find(int32_t x, int32_t y, std::vector<uint32_t>& hits) const {
+#ifdef SPLITTER_HAVE_X86_KERNELS
+        if (cpu_has_avx2()) {
+            find_avx2(x, y, hits);
+            return;
+        }
+#endif
+        find_scalar(x, y, hits);
+    }
+
+}; // class bounds_set
+
+#endif // BOUNDS_SET_HPP
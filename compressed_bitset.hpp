@@ -0,0 +1,475 @@
+#ifndef COMPRESSED_BITSET_HPP
+#define COMPRESSED_BITSET_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+#include "block_summary.hpp"
+#include "tracker_probe.hpp"
+
+/**
+ * A bitset over object ids for sparse sets, with the same interface as
+ * growing_bitset.
+ *
+ * The id space is cut into chunks of 64K ids, and only chunks that have
+ * at least one id set exist. Each chunk picks the smallest of three
+ * containers (the layout known from roaring bitmaps):
+ *   - array:  sorted list of the set low 16 bits, for up to 4096 ids
+ *   - run:    sorted list of [start, last] ranges, for long runs of ids
+ *   - bitmap: 1024 words of 64 bits, for everything else
+ */
+class compressed_bitset : public tracker_probe<compressed_bitset> {
+
+public:
+
+    typedef uint64_t word_type;
+
+private:
+
+    static const size_t chunk_bits = 16;
+    static const size_t chunk_size = 1 << chunk_bits;
+    static const size_t bitmap_words = chunk_size / 64;
+
+    // an array container is never larger than a bitmap (8 KB)
+    static const size_t max_array_size = 4096;
+
+    // a run container is never larger than a bitmap either
+    static const size_t max_runs = 2048;
+
+    struct run {
+        uint16_t start;
+        uint16_t last;
+    };
+
+    struct container {
+        enum kind_type {
+            ARRAY,
+            BITMAP,
+            RUN
+        };
+
+        kind_type kind;
+        std::vector<uint16_t> array;
+        std::vector<run> runs;
+        std::vector<word_type> bitmap;
+
+        container() : kind(ARRAY), array(), runs(), bitmap() {}
+
+        bool get(uint16_t low) const {
+            switch (kind) {
+                case ARRAY:
+                    return std::binary_search(array.begin(), array.end(), low);
+                case BITMAP:
+                    return (bitmap[low / 64] >> (low % 64)) & 1;
+                case RUN: {
+                    // first run starting after low, the one before may contain it
+                    auto it = std::upper_bound(runs.begin(), runs.end(), low, [](uint16_t v, const run& r) {
+                        return v < r.start;
+                    });
+                    return it != runs.begin() && low <= (it-1)->last;
+                }
+            }
+            return false;
+        }
+
+        void set(uint16_t low) {
+            switch (kind) {
+                case ARRAY: {
+                    auto it = std::lower_bound(array.begin(), array.end(), low);
+                    if (it != array.end() && *it == low) {
+                        return;
+                    }
+                    if (array.size() < max_array_size) {
+                        array.insert(it, low);
+                        return;
+                    }
+                    to_bitmap();
+                    set(low);
+                    return;
+                }
+                case BITMAP:
+                    bitmap[low / 64] |= word_type(1) << (low % 64);
+                    return;
+                case RUN:
+                    set_in_runs(low);
+                    return;
+            }
+        }
+
+        void set_in_runs(uint16_t low) {
+            auto it = std::upper_bound(runs.begin(), runs.end(), low, [](uint16_t v, const run& r) {
+                return v < r.start;
+            });
+
+            if (it != runs.begin()) {
+                run& prev = *(it-1);
+                if (low <= prev.last) {
+                    return;
+                }
+                if (low == prev.last + 1) {
+                    prev.last = low;
+                    // close the gap to the next run
+                    if (it != runs.end() && it->start == low + 1) {
+                        prev.last = it->last;
+                        runs.erase(it);
+                    }
+                    return;
+                }
+            }
+
+            if (it != runs.end() && it->start == low + 1) {
+                it->start = low;
+                return;
+            }
+
+            if (runs.size() >= max_runs) {
+                to_bitmap();
+                set(low);
+                return;
+            }
+
+            run r = { low, low };
+            runs.insert(it, r);
+        }
+
+        void fill_bitmap(std::vector<word_type>& words) const {
+            words.assign(bitmap_words, 0);
+            switch (kind) {
+                case ARRAY:
+                    for (const auto v : array) {
+                        words[v / 64] |= word_type(1) << (v % 64);
+                    }
+                    break;
+                case BITMAP:
+                    words = bitmap;
+                    break;
+                case RUN:
+                    for (const auto& r : runs) {
+                        for (uint32_t v = r.start; v <= r.last; v++) {
+                            words[v / 64] |= word_type(1) << (v % 64);
+                        }
+                    }
+                    break;
+            }
+        }
+
+        void to_bitmap() {
+            std::vector<word_type> words;
+            fill_bitmap(words);
+            bitmap.swap(words);
+            std::vector<uint16_t>().swap(array);
+            std::vector<run>().swap(runs);
+            kind = BITMAP;
+        }
+
+        /**
+         * re-pick the smallest container for the current content of a
+         * bitmap container.
+         */
+        void normalize() {
+            if (kind != BITMAP) {
+                to_bitmap();
+            }
+
+            size_t cardinality = 0;
+            size_t run_count = 0;
+            word_type prev_high = 0;
+            for (size_t w = 0; w < bitmap_words; w++) {
+                const word_type word = bitmap[w];
+                cardinality += __builtin_popcountll(word);
+                // a run starts at every set bit whose predecessor is unset
+                run_count += __builtin_popcountll(word & ~((word << 1) | prev_high));
+                prev_high = word >> 63;
+            }
+
+            if (run_count <= max_runs && run_count * sizeof(run) < cardinality * sizeof(uint16_t)) {
+                std::vector<run> r;
+                r.reserve(run_count);
+                for_each_low([&r](uint16_t v) {
+                    if (!r.empty() && r.back().last + 1 == v) {
+                        r.back().last = v;
+                    } else {
+                        run n = { v, v };
+                        r.push_back(n);
+                    }
+                });
+                runs.swap(r);
+                std::vector<word_type>().swap(bitmap);
+                kind = RUN;
+            } else if (cardinality <= max_array_size) {
+                std::vector<uint16_t> a;
+                a.reserve(cardinality);
+                for_each_low([&a](uint16_t v) {
+                    a.push_back(v);
+                });
+                array.swap(a);
+                std::vector<word_type>().swap(bitmap);
+                kind = ARRAY;
+            }
+        }
+
+        size_t count() const {
+            size_t n = 0;
+            switch (kind) {
+                case ARRAY:
+                    n = array.size();
+                    break;
+                case BITMAP:
+                    for (const auto word : bitmap) {
+                        n += __builtin_popcountll(word);
+                    }
+                    break;
+                case RUN:
+                    for (const auto& r : runs) {
+                        n += r.last - r.start + 1;
+                    }
+                    break;
+            }
+            return n;
+        }
+
+        template <typename TFunc>
+        void for_each_low(TFunc func) const {
+            switch (kind) {
+                case ARRAY:
+                    for (const auto v : array) {
+                        func(v);
+                    }
+                    break;
+                case BITMAP:
+                    for (size_t w = 0; w < bitmap_words; w++) {
+                        word_type word = bitmap[w];
+                        while (word) {
+                            func(static_cast<uint16_t>(w * 64 + __builtin_ctzll(word)));
+                            word &= word - 1;
+                        }
+                    }
+                    break;
+                case RUN:
+                    for (const auto& r : runs) {
+                        for (uint32_t v = r.start; v <= r.last; v++) {
+                            func(static_cast<uint16_t>(v));
+                        }
+                    }
+                    break;
+            }
+        }
+    };
+
+    // sorted chunk numbers and their containers
+    std::vector<uint64_t> keys;
+    std::vector<container> containers;
+
+    // turns down most ids that are not set before the chunk search
+    block_summary m_summary;
+
+    // index of the chunk hit last, ids mostly come in ascending order
+    mutable size_t last_chunk = 0;
+
+    // ids of the current probe() that passed the summary, with the index
+    // of their item, kept to save allocating it for every way
+    mutable std::vector<std::pair<osmium::object_id_type, size_t>> m_probe_ids;
+
+    static uint64_t chunk(const osmium::object_id_type pos) {
+        return static_cast<uint64_t>(pos) >> chunk_bits;
+    }
+
+    static uint16_t low_bits(const osmium::object_id_type pos) {
+        return static_cast<uint16_t>(pos & (chunk_size - 1));
+    }
+
+    // index of chunk key in keys, or keys.size() if it doesn't exist
+    size_t find_chunk(uint64_t key) const {
+        if (last_chunk < keys.size() && keys[last_chunk] == key) {
+            return last_chunk;
+        }
+
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        if (it == keys.end() || *it != key) {
+            return keys.size();
+        }
+
+        last_chunk = it - keys.begin();
+        return last_chunk;
+    }
+
+    container& find_or_add_chunk(uint64_t key) {
+        size_t index = find_chunk(key);
+        if (index != keys.size()) {
+            return containers[index];
+        }
+
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        index = it - keys.begin();
+        keys.insert(it, key);
+        containers.insert(containers.begin() + index, container());
+        last_chunk = index;
+        return containers[index];
+    }
+
+    friend class tracker_probe<compressed_bitset>;
+
+    // the batched lookup for tracker_probe. there is nothing to prefetch,
+    // instead the ids the summary lets through are sorted and the chunk
+    // keys are walked once for all of them, each search only looking at
+    // the keys after the chunk of the previous id.
+    template <typename TIterator, typename TRef>
+    bool probe(TIterator begin, TIterator end, TRef ref, std::vector<bool>* hits) const {
+        m_probe_ids.clear();
+        size_t n = 0;
+        osmium::object_id_type id;
+        for (TIterator it = begin; it != end; ++it, ++n) {
+            if (ref(*it, id) && m_summary.get(id)) {
+                m_probe_ids.emplace_back(id, n);
+            }
+        }
+
+        if (hits) {
+            hits->assign(n, false);
+        }
+        if (m_probe_ids.empty()) {
+            return false;
+        }
+
+        std::sort(m_probe_ids.begin(), m_probe_ids.end());
+
+        bool any = false;
+        uint64_t key = chunk(m_probe_ids.front().first);
+        size_t index = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        for (const auto& p : m_probe_ids) {
+            if (chunk(p.first) != key) {
+                key = chunk(p.first);
+                index = std::lower_bound(keys.begin() + index, keys.end(), key) - keys.begin();
+            }
+            if (index == keys.size()) {
+                break;
+            }
+            if (keys[index] != key || !containers[index].get(low_bits(p.first))) {
+                continue;
+            }
+
+            if (!hits) {
+                return true;
+            }
+            (*hits)[p.second] = true;
+            any = true;
+        }
+        return any;
+    }
+
+public:
+
+    void set(const osmium::object_id_type pos) {
+        m_summary.set(pos);
+        find_or_add_chunk(chunk(pos)).set(low_bits(pos));
+    }
+
+    bool get(const osmium::object_id_type pos) const {
+        if (!m_summary.get(pos)) return false;
+        const size_t index = find_chunk(chunk(pos));
+        if (index == keys.size()) return false;
+        return containers[index].get(low_bits(pos));
+    }
+
+    /**
+     * release all chunks, leaving an empty set
+     */
+    void clear() {
+        std::vector<uint64_t>().swap(keys);
+        std::vector<container>().swap(containers);
+        m_summary.clear();
+        last_chunk = 0;
+    }
+
+    /**
+     * the blocks of ids that may be set
+     */
+    const block_summary& summary() const {
+        return m_summary;
+    }
+
+    /**
+     * set every bit that is set in other
+     */
+    compressed_bitset& operator|=(const compressed_bitset& other) {
+        m_summary |= other.m_summary;
+        std::vector<word_type> words;
+        for (size_t i = 0; i < other.keys.size(); i++) {
+            container& dst = find_or_add_chunk(other.keys[i]);
+            if (dst.kind != container::BITMAP) {
+                dst.to_bitmap();
+            }
+            other.containers[i].fill_bitmap(words);
+            for (size_t w = 0; w < bitmap_words; w++) {
+                dst.bitmap[w] |= words[w];
+            }
+            dst.normalize();
+        }
+        return *this;
+    }
+
+    /**
+     * clear every bit that is not set in other
+     */
+    compressed_bitset& operator&=(const compressed_bitset& other) {
+        m_summary &= other.m_summary;
+        std::vector<uint64_t> new_keys;
+        std::vector<container> new_containers;
+        std::vector<word_type> words;
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            const size_t o = other.find_chunk(keys[i]);
+            if (o == other.keys.size()) continue;
+
+            container& dst = containers[i];
+            dst.to_bitmap();
+            other.containers[o].fill_bitmap(words);
+            bool empty = true;
+            for (size_t w = 0; w < bitmap_words; w++) {
+                dst.bitmap[w] &= words[w];
+                empty = empty && !dst.bitmap[w];
+            }
+            if (empty) continue;
+
+            dst.normalize();
+            new_keys.push_back(keys[i]);
+            new_containers.push_back(std::move(dst));
+        }
+
+        keys.swap(new_keys);
+        containers.swap(new_containers);
+        last_chunk = 0;
+        return *this;
+    }
+
+    /**
+     * number of set bits
+     */
+    size_t count() const {
+        size_t n = 0;
+        for (const auto& c : containers) {
+            n += c.count();
+        }
+        return n;
+    }
+
+    /**
+     * call func(id) for every set bit, in ascending order
+     */
+    template <typename TFunc>
+    void for_each(TFunc func) const {
+        for (size_t i = 0; i < keys.size(); i++) {
+            const osmium::object_id_type base = static_cast<osmium::object_id_type>(keys[i] << chunk_bits);
+            containers[i].for_each_low([&func, base](uint16_t low) {
+                func(base + low);
+            });
+        }
+    }
+
+}; // class compressed_bitset
+
+#endif // COMPRESSED_BITSET_HPP
@@ -0,0 +1,26 @@
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+/**
+ * Runtime detection of the instruction sets the geometry kernels can use.
+ *
+ * The AVX2 kernels are compiled with a target attribute next to their
+ * scalar versions, so the binary runs on any x86-64 and only uses AVX2
+ * where the CPU has it. Other architectures always take the scalar path.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SPLITTER_HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+inline bool cpu_has_avx2() {
+#ifdef SPLITTER_HAVE_X86_KERNELS
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+#endif // CPU_FEATURES_HPP
@@ -1,9 +1,22 @@
 #ifndef SPLITTER_CUT_HPP
 #define SPLITTER_CUT_HPP
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include <osmium/io/any_output.hpp>
+#include <osmium/osm/entity_bits.hpp>
 
+#include "block_summary.hpp"
+#include "extract_grid.hpp"
+#include "fixed_point_polygon.hpp"
 #include "geometryreader.hpp"
+#include "partition_index.hpp"
+#include "polygon_raster.hpp"
+#include "splice_writer.hpp"
+#include "version_grouper.hpp"
 
 // information about a single extract
 class ExtractInfo {
@@ -15,42 +28,68 @@ public:
     };
 
     std::string name;
-    geos::algorithm::locate::IndexedPointInAreaLocator *locator;
+    size_t index;
+
+    // the extract this one is nested inside, nullptr at the top level
+    ExtractInfo *parent;
+
+    // extracts nested inside this one directly follow it in
+    // CutInfo::extracts, up to but not including subtree_end
+    size_t subtree_end;
+
+    // this extract is found through the partition_index of its siblings
+    // instead of being tested on its own
+    bool partitioned;
+
+    // partition of the polygon extracts nested directly inside this one,
+    // owned by CutInfo
+    const partition_index *nested_partition;
+
+    fixed_point_polygon *polygon;
+    polygon_raster *raster;
     osmium::Box bounds;
-    osmium::io::Writer writer;
+    splice_writer writer;
     ExtractMode mode;
     osmium::memory::Buffer m_buffer;
 
+    // the objects written now are in a raw blob spliced into the output,
+    // write() leaves them out
+    bool passed_through;
+
     ExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
-        locator(nullptr),
+        index(0),
+        parent(nullptr),
+        subtree_end(0),
+        partitioned(false),
+        nested_partition(nullptr),
+        polygon(nullptr),
+        raster(nullptr),
         writer(file, header),
-        m_buffer(1024*1024, osmium::memory::Buffer::auto_grow::yes) {
+        m_buffer(1024*1024, osmium::memory::Buffer::auto_grow::yes),
+        passed_through(false) {
         this->name = name;
     }
 
     ~ExtractInfo() {
         flush();
         writer.close();
-        if (locator) delete locator;
+        if (polygon) delete polygon;
+        if (raster) delete raster;
     }
 
-    bool contains(const osmium::Node& node) {
-        if (mode == BOUNDS) {
-            return
-                (node.location().lon() > bounds.bottom_left().lon()) &&
-                (node.location().lat() > bounds.bottom_left().lat()) &&
-                (node.location().lon() < bounds.top_right().lon()) &&
-                (node.location().lat() < bounds.top_right().lat());
-        } else if (mode == LOCATOR) {
-            // BOUNDARY 1
-            // EXTERIOR 2
-            // INTERIOR 0
+    /**
+     * is location inside the extract, which has to be of mode TMode. lets
+     * loops over extracts of one mode do without the branch on mode.
+     * safe to call from several threads at once.
+     */
+    template <ExtractMode TMode>
+    bool contains(const osmium::Location& location) const;
 
-            geos::geom::Coordinate c = geos::geom::Coordinate(node.location().lon(), node.location().lat(), DoubleNotANumber);
-            return (0 == locator->locate(&c));
-        }
+    // safe to call from several threads at once
+    bool contains(const osmium::Location& location) const;
 
-        return false;
+    bool contains(const osmium::Node& node) const {
+        return contains(node.location());
     }
 
     void flush() {
@@ -60,7 +99,17 @@ public:
         writer(std::move(new_buffer));
     }
 
+    /**
+     * copy object into the buffer of the extract. every extract taking
+     * the object gets a copy of its own: the osmium Writer takes a Buffer
+     * it owns and encodes it later on threads of its own, with no way to
+     * tell when it is done with it, and each extract takes another subset
+     * of the input. whole blobs an extract takes are spliced in instead.
+     */
     void write(const osmium::OSMObject& object) {
+        if (passed_through) {
+            return;
+        }
         m_buffer.add_item(object);
         m_buffer.commit();
         if (m_buffer.committed() > 900 * 1024) {
@@ -68,8 +117,49 @@ public:
         }
     }
 
+    /**
+     * copy the raw PBF blob data of size bytes to the output, after all
+     * objects written before. returns false if that fails.
+     */
+    bool splice(const char* data, size_t size) {
+        flush();
+        return writer.splice(data, size);
+    }
+
 };
 
+template <>
+inline bool ExtractInfo::contains<ExtractInfo::BOUNDS>(const osmium::Location& location) const {
+    // all four comparisons are evaluated, there is nothing to branch on
+    return
+        (location.x() > bounds.bottom_left().x()) &
+        (location.y() > bounds.bottom_left().y()) &
+        (location.x() < bounds.top_right().x()) &
+        (location.y() < bounds.top_right().y());
+}
+
+template <>
+inline bool ExtractInfo::contains<ExtractInfo::LOCATOR>(const osmium::Location& location) const {
+    const int32_t x = location.x();
+    const int32_t y = location.y();
+
+    // most nodes are decided by the raster alone
+    switch (raster->classify(x, y)) {
+        case polygon_raster::inside:
+            return true;
+        case polygon_raster::outside:
+            return false;
+        case polygon_raster::boundary:
+            break;
+    }
+
+    return polygon->contains(x, y);
+}
+
+inline bool ExtractInfo::contains(const osmium::Location& location) const {
+    return (mode == BOUNDS) ? contains<BOUNDS>(location) : contains<LOCATOR>(location);
+}
+
 // information about the cutting algorithm
 template <class TExtractInfo>
 class CutInfo {
@@ -81,10 +171,227 @@ protected:
         }
     }
 
+private:
+
+    void arrange_subtree(TExtractInfo* extract, const std::vector<std::vector<TExtractInfo*>>& children, std::vector<TExtractInfo*>& ordered) {
+        const size_t old_index = extract->index;
+        extract->index = ordered.size();
+        ordered.push_back(extract);
+        for (const auto& child : children[old_index]) {
+            arrange_subtree(child, children, ordered);
+        }
+        extract->subtree_end = ordered.size();
+    }
+
+    // index the polygon extracts among siblings in a partition_index,
+    // if there are enough of them to be worth it
+    const partition_index* make_partition(const std::vector<TExtractInfo*>& siblings) {
+        std::vector<partition_index::member> members;
+        for (const auto& extract : siblings) {
+            if (extract->mode == ExtractInfo::LOCATOR) {
+                members.push_back(partition_index::member { static_cast<uint32_t>(extract->index), extract->polygon });
+            }
+        }
+        if (members.size() < 2) {
+            return nullptr;
+        }
+
+        for (const auto& extract : siblings) {
+            extract->partitioned = (extract->mode == ExtractInfo::LOCATOR);
+        }
+        m_partitions.emplace_back(new partition_index(members));
+        return m_partitions.back().get();
+    }
+
+    // record extract i as containing location and descend into the
+    // extracts nested inside it
+    template <typename TKnown>
+    void add_hit(size_t i, const osmium::Location& location, std::vector<uint32_t>& hits, TKnown known) const {
+        hits.push_back(i);
+        if (extracts[i]->subtree_end > i + 1) {
+            find_nested(i, location, hits, known);
+        }
+    }
+
+    // append the extracts of group that contain location to hits. the
+    // boxes and the polygons of a group are tested in separate loops, so
+    // neither needs to look at the mode of an extract.
+    template <typename TKnown>
+    void find_in(const extract_grid::cell& group, const osmium::Location& location, std::vector<uint32_t>& hits, TKnown known) const {
+        const size_t first = hits.size();
+        group.boxes.find(location.x(), location.y(), hits);
+        const size_t boxes_end = hits.size();
+        for (size_t h = first; h < boxes_end; h++) {
+            if (extracts[hits[h]]->subtree_end > hits[h] + 1) {
+                find_nested(hits[h], location, hits, known);
+            }
+        }
+
+        for (const uint32_t i : group.extracts) {
+            if (known(i) || extracts[i]->template contains<ExtractInfo::LOCATOR>(location)) {
+                add_hit(i, location, hits, known);
+            }
+        }
+    }
+
+    // append the extracts nested inside extract parent that contain
+    // location to hits
+    template <typename TKnown>
+    void find_nested(size_t parent, const osmium::Location& location, std::vector<uint32_t>& hits, TKnown known) const {
+        find_in(m_children[parent], location, hits, known);
+
+        uint32_t owner;
+        const partition_index* partition = extracts[parent]->nested_partition;
+        if (partition && partition->find(location.x(), location.y(), owner)) {
+            add_hit(owner, location, hits, known);
+        }
+    }
+
+    // no extract is known to contain a location before it is tested
+    struct none_known {
+        bool operator()(uint32_t) const {
+            return false;
+        }
+    };
+
+    // the extracts nested directly inside every extract, split by mode
+    // like the top level extracts in the grid. partitioned extracts are
+    // left out.
+    std::vector<extract_grid::cell> m_children;
+
+    std::vector<std::unique_ptr<partition_index>> m_partitions;
+
+    // partition of the top level polygon extracts
+    const partition_index *m_top_partition = nullptr;
+
 public:
+    typedef TExtractInfo extract_info_type;
+
     std::vector<TExtractInfo*> extracts;
 
-    TExtractInfo *addExtract(const std::string& name, double minlon, double minlat, double maxlon, double maxlat) {
+    // top level extracts by the area their bounds cover
+    extract_grid grid;
+
+    // blocks of ids holding an object recorded for any extract. the cuts
+    // fill them in before a pass that only writes out recorded objects, so
+    // objects in no extract skip the extracts altogether.
+    block_summary node_blocks;
+    block_summary way_blocks;
+    block_summary relation_blocks;
+
+    /**
+     * may an object of type with an id in [first, last] be recorded for
+     * any extract, going by the block summaries?
+     */
+    bool recorded(osmium::item_type type, osmium::object_id_type first, osmium::object_id_type last) const {
+        switch (type) {
+            case osmium::item_type::node:
+                return node_blocks.any(first, last);
+            case osmium::item_type::way:
+                return way_blocks.any(first, last);
+            default:
+                return relation_blocks.any(first, last);
+        }
+    }
+
+    /**
+     * put the extracts in preorder, so every extract is directly followed
+     * by the ones nested inside it, and enter the top level extracts into
+     * the grid. must be called once after all extracts were added.
+     *
+     * with partition set, polygon extracts sharing a parent are promised
+     * not to overlap and get found through one partition_index each.
+     */
+    void arrange(bool partition = false) {
+        std::vector<std::vector<TExtractInfo*>> children(extracts.size());
+        std::vector<TExtractInfo*> roots;
+        for (const auto& extract : extracts) {
+            if (extract->parent) {
+                children[extract->parent->index].push_back(extract);
+            } else {
+                roots.push_back(extract);
+            }
+        }
+
+        std::vector<TExtractInfo*> ordered;
+        for (const auto& root : roots) {
+            arrange_subtree(root, children, ordered);
+        }
+        extracts.swap(ordered);
+
+        if (partition) {
+            m_top_partition = make_partition(roots);
+            for (const auto& siblings : children) {
+                if (!siblings.empty()) {
+                    siblings.front()->parent->nested_partition = make_partition(siblings);
+                }
+            }
+        }
+
+        m_children.assign(extracts.size(), extract_grid::cell());
+        for (const auto& extract : extracts) {
+            if (!extract->parent) {
+                if (extract->mode == ExtractInfo::BOUNDS) {
+                    grid.insert_box(extract->bounds, extract->index);
+                } else if (!extract->partitioned) {
+                    grid.insert(extract->bounds, extract->index);
+                }
+            } else {
+                extract_grid::cell& siblings = m_children[extract->parent->index];
+                if (extract->mode == ExtractInfo::BOUNDS) {
+                    siblings.boxes.add(extract->bounds, extract->index);
+                } else if (!extract->partitioned) {
+                    siblings.extracts.push_back(extract->index);
+                }
+            }
+        }
+    }
+
+    /**
+     * append the numbers of all extracts containing location to hits, not
+     * sorted. nested extracts are only tested if their parent contains
+     * location.
+     *
+     * polygon extracts for which known(number) returns true are taken to
+     * contain location without a test, so the caller can pass on what it
+     * already found out about another version of the same node.
+     */
+    template <typename TKnown>
+    void find_extracts(const osmium::Location& location, std::vector<uint32_t>& hits, TKnown known) const {
+        const extract_grid::cell* cell = grid.find(location);
+        if (cell) {
+            find_in(*cell, location, hits, known);
+        }
+
+        uint32_t owner;
+        if (m_top_partition && m_top_partition->find(location.x(), location.y(), owner)) {
+            add_hit(owner, location, hits, known);
+        }
+    }
+
+    void find_extracts(const osmium::Location& location, std::vector<uint32_t>& hits) const {
+        find_extracts(location, hits, none_known());
+    }
+
+    /**
+     * classify count locations at once. the extracts containing
+     * locations[n] are appended to hits, starting at begin[n] and ending
+     * before end[n].
+     */
+    void classify(const osmium::Location* locations, size_t count, std::vector<uint32_t>& hits, uint32_t* begin, uint32_t* end) const {
+        for (size_t n = 0; n < count; n++) {
+            begin[n] = hits.size();
+            find_extracts(locations[n], hits);
+            end[n] = hits.size();
+        }
+    }
+
+    /**
+     * add an extract nested inside parent, or at the top level if parent is
+     * nullptr. the area of an extract must lie within the area of its
+     * parent, nodes outside the parent are never tested against it.
+     */
+    TExtractInfo *addExtract(const std::string& name, double minlon, double minlat, double maxlon, double maxlat, TExtractInfo *parent = nullptr) {
         std::cerr << "opening writer for " << name.c_str() << "\n";
         osmium::io::File outfile(name);
 
@@ -98,20 +405,31 @@ public:
         header.add_box(bounds);
 
         TExtractInfo *ex = new TExtractInfo(name, outfile, header);
+        ex->index = extracts.size();
         ex->bounds = bounds;
+        ex->parent = parent;
         ex->mode = ExtractInfo::BOUNDS;
 
         extracts.push_back(ex);
         return ex;
     }
 
-    TExtractInfo *addExtract(const std::string& name, geos::geom::Geometry *poly) {
+    TExtractInfo *addExtract(const std::string& name, geos::geom::Geometry *poly, TExtractInfo *parent = nullptr) {
+        fixed_point_polygon *polygon = new fixed_point_polygon(*poly);
+        return addExtract(name, polygon, new polygon_raster(*polygon), parent);
+    }
+
+    /**
+     * add a polygon extract from its prepared geometry, as built from a
+     * GEOS geometry or loaded from the geometry_cache. takes ownership of
+     * polygon and raster.
+     */
+    TExtractInfo *addExtract(const std::string& name, fixed_point_polygon *polygon, polygon_raster *raster, TExtractInfo *parent = nullptr) {
         std::cerr << "opening writer for " << name.c_str() << "\n";
         osmium::io::File outfile(name);
 
-        const geos::geom::Envelope *env = poly->getEnvelopeInternal();
-        const osmium::Location min(env->getMinX(), env->getMinY());
-        const osmium::Location max(env->getMaxX(), env->getMaxY());
+        const osmium::Location min(polygon->min_x(), polygon->min_y());
+        const osmium::Location max(polygon->max_x(), polygon->max_y());
 
         osmium::Box bounds;
         bounds.extend(min).extend(max);
@@ -120,11 +438,13 @@ public:
         header.add_box(bounds);
 
         TExtractInfo *ex = new TExtractInfo(name, outfile, header);
-        ex->locator = new geos::algorithm::locate::IndexedPointInAreaLocator(*poly);
+        ex->index = extracts.size();
+        ex->bounds = bounds;
+        ex->polygon = polygon;
+        ex->raster = raster;
+        ex->parent = parent;
         ex->mode = ExtractInfo::LOCATOR;
 
-//XXX        Osmium::Geometry::geos_geometry_factory()->destroyGeometry(poly);
-
         extracts.push_back(ex);
         return ex;
     }
@@ -133,14 +453,183 @@ public:
 template <class TCutInfo>
 class Cut : public osmium::handler::Handler {
 
+public:
+
+    typedef typename TCutInfo::extract_info_type extract_info_type;
+
 protected:
 
     TCutInfo *info;
 
+private:
+
+    // extract numbers containing the next node, if a NodeClassifier
+    // already did the work
+    bool m_classified;
+    const uint32_t* m_classified_begin;
+    const uint32_t* m_classified_end;
+
+    std::vector<uint32_t> m_hits;
+    std::vector<extract_info_type*> m_containing;
+
+    void hits_to_extracts() {
+        m_containing.clear();
+        for (const uint32_t i : m_hits) {
+            m_containing.push_back(info->extracts[i]);
+        }
+    }
+
+protected:
+
+    // the ids of the nodes of all versions of a way, sorted and without
+    // duplicates, and for every node of every version in turn its
+    // position in m_node_ids. filled in by collect_node_ids().
+    std::vector<osmium::object_id_type> m_node_ids;
+    std::vector<uint32_t> m_node_index;
+
+    /**
+     * call func(extract) for all extracts in order, skipping the extracts
+     * nested inside an extract for which func returned false. func returns
+     * whether the current object is part of the extract.
+     *
+     * only for sets where a nested extract never holds an object its
+     * parent doesn't: the nodes inside an extract, and what softcut builds
+     * from them. the outside objects of softercut and supersoftercut come
+     * from all versions of a way or relation, a nested extract can get an
+     * outside node its parent never sees, so their writing passes walk all
+     * extracts.
+     */
+    template <typename TFunc>
+    void for_each_nested(TFunc func) {
+        const auto& extracts = info->extracts;
+        size_t i = 0;
+        while (i < extracts.size()) {
+            i = func(extracts[i]) ? i + 1 : extracts[i]->subtree_end;
+        }
+    }
+
+    // all extracts the node is inside of
+    const std::vector<extract_info_type*>& extracts_containing(const osmium::Node& node) {
+        m_containing.clear();
+
+        if (m_classified) {
+            for (const uint32_t* i = m_classified_begin; i != m_classified_end; ++i) {
+                m_containing.push_back(info->extracts[*i]);
+            }
+            m_classified = false;
+            return m_containing;
+        }
+
+        m_hits.clear();
+        info->find_extracts(node.location(), m_hits);
+        hits_to_extracts();
+        return m_containing;
+    }
+
+    /**
+     * all extracts any version of the node is inside of. a version at the
+     * location of the version before it is not looked at again, and the
+     * polygons of extracts containing an earlier version are not tested
+     * again.
+     */
+    const std::vector<extract_info_type*>& extracts_containing(const version_group<osmium::Node>& versions) {
+        m_hits.clear();
+
+        if (versions.classified()) {
+            for (size_t n = 0; n < versions.size(); n++) {
+                m_hits.insert(m_hits.end(), versions.hits_begin(n), versions.hits_end(n));
+            }
+        } else {
+            const std::vector<uint32_t>& hits = m_hits;
+            for (size_t n = 0; n < versions.size(); n++) {
+                if (n > 0 && versions[n].location() == versions[n-1].location()) {
+                    continue;
+                }
+                info->find_extracts(versions[n].location(), m_hits, [&hits](uint32_t i) {
+                    return std::find(hits.begin(), hits.end(), i) != hits.end();
+                });
+            }
+        }
+
+        std::sort(m_hits.begin(), m_hits.end());
+        m_hits.erase(std::unique(m_hits.begin(), m_hits.end()), m_hits.end());
+        hits_to_extracts();
+        return m_containing;
+    }
+
+    /**
+     * fill m_node_ids and m_node_index from all versions of a way
+     */
+    void collect_node_ids(const version_group<osmium::Way>& versions) {
+        m_node_ids.clear();
+        for (const osmium::Way* way : versions) {
+            for (const auto& node_ref : way->nodes()) {
+                m_node_ids.push_back(node_ref.ref());
+            }
+        }
+        std::sort(m_node_ids.begin(), m_node_ids.end());
+        m_node_ids.erase(std::unique(m_node_ids.begin(), m_node_ids.end()), m_node_ids.end());
+
+        m_node_index.clear();
+        for (const osmium::Way* way : versions) {
+            for (const auto& node_ref : way->nodes()) {
+                m_node_index.push_back(std::lower_bound(m_node_ids.begin(), m_node_ids.end(), node_ref.ref()) - m_node_ids.begin());
+            }
+        }
+    }
+
 public:
 
     bool debug;
-    Cut(TCutInfo *info) : info(info) {}
+    Cut(TCutInfo *info) :
+        info(info),
+        m_classified(false),
+        m_classified_begin(nullptr),
+        m_classified_end(nullptr),
+        m_hits(),
+        m_containing(),
+        m_node_ids(),
+        m_node_index(),
+        debug(false) {}
+
+    /**
+     * the entity types the pass looks at, the driver doesn't read the
+     * others. passes looking at fewer types hide this.
+     */
+    static osmium::osm_entity_bits::type entities() {
+        return osmium::osm_entity_bits::nwr;
+    }
+
+    /**
+     * may a blob of the input holding objects of type with ids in
+     * [first, last] hold one the pass looks at? passes that know hide
+     * this, the others read every blob of the types they look at.
+     */
+    bool wants(osmium::item_type, osmium::object_id_type, osmium::object_id_type) const {
+        return true;
+    }
+
+    /**
+     * does the pass write object to extract, and nothing else for it?
+     * passes that write out what the passes before them recorded hide
+     * this with an overload for nodes, ways and relations, and raw blobs
+     * of the input all of whose objects an extract selects are then
+     * copied to it unchanged.
+     */
+    bool selects(const extract_info_type*, const osmium::OSMObject&) const {
+        return false;
+    }
+
+    const std::vector<extract_info_type*>& extracts() const {
+        return info->extracts;
+    }
+
+    // the extract numbers containing the next node handed to node()
+    void classified(const uint32_t* begin, const uint32_t* end) {
+        m_classified = true;
+        m_classified_begin = begin;
+        m_classified_end = end;
+    }
 };
 
 #endif // SPLITTER_CUT_HPP
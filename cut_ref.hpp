@@ -2,7 +2,7 @@
 #define SPLITTER_CUT_REF_HPP
 
 #include "cut.hpp"
-#include "growing_bitset.hpp"
+#include "id_tracker.hpp"
 #include <map>
 #include <tuple>
 #include <typeinfo>
@@ -58,11 +58,11 @@ class Cut_refExtractInfo : public ExtractInfo {
 
 public:
 						
-    growing_bitset node_tracker;	//nodes 
+    id_tracker node_tracker;	//nodes 
 
-    growing_bitset way_tracker;	//ways 	
+    id_tracker way_tracker;	//ways 	
 
-    growing_bitset relation_tracker;	//relations    
+    id_tracker relation_tracker;	//relations    
 
 
     Cut_refExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
@@ -89,6 +89,11 @@ public:
         std::cout << "\n\n===cut_ref first-pass===\n\n";
     }
 
+    // only ways and relations are looked at
+    static osmium::osm_entity_bits::type entities() {
+        return osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation;
+    }
+
     // - walk over all relations-versions
     //   - walk over all relations-nodes
     //     - Adds the nodes and ways that aren't in node-tracker to a vector
@@ -171,6 +176,11 @@ public:
         std::cout << "\n\n===cut_ref second-pass===\n\n";
     }
 
+    // only ways are looked at
+    static osmium::osm_entity_bits::type entities() {
+        return osmium::osm_entity_bits::way;
+    }
+
     // - walk over all way-versions
     //   - walk over all bboxes
     //     - if the way-id is recorded in the bboxes way-trackers
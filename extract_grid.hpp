@@ -0,0 +1,118 @@
+#ifndef EXTRACT_GRID_HPP
+#define EXTRACT_GRID_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+
+#include "bounds_set.hpp"
+
+/**
+ * A uniform grid of one degree cells over the whole world, listing for
+ * every cell the extracts whose bounding box touches it.
+ *
+ * A node can only be inside the extracts listed for its cell, so it needs
+ * to be tested against a handful of candidates instead of every extract.
+ * Extracts that are plain boxes are kept in a bounds_set per cell, so they
+ * are tested eight at a time.
+ */
+class extract_grid {
+
+public:
+
+    // cells per degree
+    static const int64_t resolution = 1;
+
+    static const int64_t columns = 360 * resolution;
+    static const int64_t rows = 180 * resolution;
+
+    struct cell {
+        // extracts that are exactly their bounding box
+        bounds_set boxes;
+
+        // all other extracts touching the cell
+        std::vector<uint32_t> extracts;
+    };
+
+private:
+
+    // osmium stores coordinates as degrees * 10^7
+    static const int64_t cell_size = 10000000 / resolution;
+
+    // most of the world is not covered by any extract, so only cells that
+    // are get an entry in m_used. m_cells holds 1 + its index there.
+    std::vector<uint32_t> m_cells;
+    std::vector<cell> m_used;
+
+    static int64_t column(int32_t x) {
+        const int64_t c = (static_cast<int64_t>(x) + 180 * 10000000LL) / cell_size;
+        return c < 0 ? 0 : (c >= columns ? columns - 1 : c);
+    }
+
+    static int64_t row(int32_t y) {
+        const int64_t r = (static_cast<int64_t>(y) + 90 * 10000000LL) / cell_size;
+        return r < 0 ? 0 : (r >= rows ? rows - 1 : r);
+    }
+
+    template <typename TFunc>
+    void for_each_cell(const osmium::Box& bounds, TFunc func) {
+        const int64_t c0 = column(bounds.bottom_left().x());
+        const int64_t c1 = column(bounds.top_right().x());
+        const int64_t r0 = row(bounds.bottom_left().y());
+        const int64_t r1 = row(bounds.top_right().y());
+
+        for (int64_t r = r0; r <= r1; r++) {
+            for (int64_t c = c0; c <= c1; c++) {
+                uint32_t& slot = m_cells[r * columns + c];
+                if (slot == 0) {
+                    m_used.emplace_back();
+                    slot = m_used.size();
+                }
+                func(m_used[slot - 1]);
+            }
+        }
+    }
+
+public:
+
+    extract_grid() :
+        m_cells(columns * rows, 0),
+        m_used() {
+    }
+
+    /**
+     * list extract in all cells touched by bounds
+     */
+    void insert(const osmium::Box& bounds, uint32_t extract) {
+        for_each_cell(bounds, [extract](cell& c) {
+            c.extracts.push_back(extract);
+        });
+    }
+
+    /**
+     * list an extract that is exactly the box bounds in all cells touched
+     * by it
+     */
+    void insert_box(const osmium::Box& bounds, uint32_t extract) {
+        for_each_cell(bounds, [&bounds, extract](cell& c) {
+            c.boxes.add(bounds, extract);
+        });
+    }
+
+    /**
+     * the cell of location, nullptr if no extract touches it
+     */
+    const cell* find(const osmium::Location& location) const {
+        if (!location.valid()) {
+            return nullptr;
+        }
+
+        const uint32_t slot = m_cells[row(location.y()) * columns + column(location.x())];
+        return slot ? &m_used[slot - 1] : nullptr;
+    }
+
+}; // class extract_grid
+
+#endif // EXTRACT_GRID_HPP
@@ -0,0 +1,291 @@
+#ifndef EXTRACT_MEMBERSHIP_HPP
+#define EXTRACT_MEMBERSHIP_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+#include "growing_bitset.hpp"
+#include "segment_storage.hpp"
+
+/**
+ * Dictionary of sets of extracts, each set stored as a mask with one bit
+ * per extract.
+ *
+ * Every distinct set seen gets a small code, so sets can be stored per
+ * object id and united with one cached lookup per pair of codes. Code 0 is
+ * the empty set.
+ */
+class extract_masks {
+
+public:
+
+    typedef uint16_t code_type;
+
+    static const code_type none = 0;
+
+private:
+
+    typedef uint64_t word_type;
+
+    // number of words in each mask
+    size_t m_mask_words;
+
+    // mask of code c starts at m_masks[c * m_mask_words]
+    std::vector<word_type> m_masks;
+
+    // mask bytes -> code
+    std::unordered_map<std::string, code_type> m_codes;
+
+    // (code << 16 | code) -> code of the union
+    std::unordered_map<uint32_t, code_type> m_unions;
+
+    // extract number -> code of the set containing only it
+    std::vector<code_type> m_singles;
+
+    const word_type* mask(code_type code) const {
+        return &m_masks[code * m_mask_words];
+    }
+
+    code_type intern(const word_type* words) {
+        const std::string key(reinterpret_cast<const char*>(words), m_mask_words * sizeof(word_type));
+        auto it = m_codes.find(key);
+        if (it != m_codes.end()) {
+            return it->second;
+        }
+
+        const size_t code = m_masks.size() / m_mask_words;
+        if (code > 0xffff) {
+            throw std::runtime_error("more than 65536 distinct combinations of extracts");
+        }
+
+        m_masks.insert(m_masks.end(), words, words + m_mask_words);
+        m_codes[key] = static_cast<code_type>(code);
+        return static_cast<code_type>(code);
+    }
+
+public:
+
+    extract_masks() :
+        m_mask_words(0),
+        m_masks(),
+        m_codes(),
+        m_unions(),
+        m_singles() {
+    }
+
+    /**
+     * set up the dictionary for extract_count extracts, must be called
+     * before any code is used.
+     */
+    void set_extract_count(size_t extract_count) {
+        m_mask_words = (extract_count + 63) / 64;
+        if (m_mask_words == 0) {
+            m_mask_words = 1;
+        }
+        m_masks.clear();
+        m_codes.clear();
+        m_unions.clear();
+
+        std::vector<word_type> words(m_mask_words, 0);
+        intern(words.data());
+
+        m_singles.resize(extract_count);
+        for (size_t e = 0; e < extract_count; e++) {
+            words.assign(m_mask_words, 0);
+            words[e / 64] = word_type(1) << (e % 64);
+            m_singles[e] = intern(words.data());
+        }
+    }
+
+    /**
+     * code of the set containing only extract
+     */
+    code_type single(size_t extract) const {
+        return m_singles[extract];
+    }
+
+    /**
+     * code of the union of the sets a and b
+     */
+    code_type merge(code_type a, code_type b) {
+        if (a == b || b == none) return a;
+        if (a == none) return b;
+        if (a > b) std::swap(a, b);
+
+        const uint32_t key = (static_cast<uint32_t>(a) << 16) | b;
+        auto it = m_unions.find(key);
+        if (it != m_unions.end()) {
+            return it->second;
+        }
+
+        std::vector<word_type> words(mask(a), mask(a) + m_mask_words);
+        const word_type* other = mask(b);
+        for (size_t w = 0; w < m_mask_words; w++) {
+            words[w] |= other[w];
+        }
+
+        const code_type code = intern(words.data());
+        m_unions[key] = code;
+        return code;
+    }
+
+    bool contains(code_type code, size_t extract) const {
+        return (mask(code)[extract / 64] >> (extract % 64)) & 1;
+    }
+
+    /**
+     * call func(extract) for every extract in the set code
+     */
+    template <typename TFunc>
+    void for_each_extract(code_type code, TFunc func) const {
+        if (code == none) return;
+
+        const word_type* words = mask(code);
+        for (size_t w = 0; w < m_mask_words; w++) {
+            word_type word = words[w];
+            while (word) {
+                func(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+}; // class extract_masks
+
+
+/**
+ * Records for every object id the set of extracts it belongs to, instead
+ * of one bitset per extract. A single load answers "which extracts include
+ * this id" no matter how many extracts there are.
+ *
+ * Only the code of the set in an extract_masks dictionary is stored per
+ * id. Codes are one byte wide as long as they fit and get widened to two
+ * bytes when the dictionary grows past 256 sets. Ids that were never
+ * added belong to no extract.
+ */
+class extract_membership {
+
+public:
+
+    typedef extract_masks::code_type code_type;
+
+private:
+
+    // per-id storage comes from the same segment_storage as the trackers
+    static const size_t segment_bytes = growing_bitset::segment_words * sizeof(growing_bitset::word_type);
+
+    struct segment_deleter {
+        void operator()(unsigned char* bytes) const {
+            segment_storage::instance().release(bytes);
+        }
+    };
+
+    typedef std::unique_ptr<unsigned char, segment_deleter> segment_ptr_type;
+
+    extract_masks& m_masks;
+
+    std::vector<segment_ptr_type> m_segments;
+
+    // 1 or 2
+    size_t m_code_bytes;
+
+    size_t ids_per_segment() const {
+        return segment_bytes / m_code_bytes;
+    }
+
+    // switch from one to two byte codes
+    void widen() {
+        std::vector<segment_ptr_type> segments;
+        segments.resize(m_segments.size() * 2);
+
+        for (size_t s = 0; s < m_segments.size(); s++) {
+            const unsigned char* src = m_segments[s].get();
+            if (!src) continue;
+
+            for (size_t half = 0; half < 2; half++) {
+                uint16_t* dst = static_cast<uint16_t*>(segment_storage::instance().allocate(segment_bytes));
+                segments[s * 2 + half].reset(reinterpret_cast<unsigned char*>(dst));
+                const unsigned char* part = src + half * (segment_bytes / 2);
+                for (size_t i = 0; i < segment_bytes / 2; i++) {
+                    dst[i] = part[i];
+                }
+            }
+        }
+
+        m_segments.swap(segments);
+        m_code_bytes = 2;
+    }
+
+    unsigned char* find_segment(size_t segment) {
+        if (segment >= m_segments.size()) {
+            m_segments.resize(segment+1);
+        }
+
+        auto ptr = m_segments[segment].get();
+        if (!ptr) {
+            ptr = static_cast<unsigned char*>(segment_storage::instance().allocate(segment_bytes));
+            m_segments[segment].reset(ptr);
+        }
+
+        return ptr;
+    }
+
+public:
+
+    explicit extract_membership(extract_masks& masks) :
+        m_masks(masks),
+        m_segments(),
+        m_code_bytes(1) {
+    }
+
+    /**
+     * code of the set of extracts id belongs to
+     */
+    code_type get(const osmium::object_id_type id) const {
+        const size_t segment = id / ids_per_segment();
+        if (segment >= m_segments.size()) return extract_masks::none;
+
+        const unsigned char* bytes = m_segments[segment].get();
+        if (!bytes) return extract_masks::none;
+
+        const size_t pos = id % ids_per_segment();
+        if (m_code_bytes == 1) {
+            return bytes[pos];
+        }
+        return reinterpret_cast<const uint16_t*>(bytes)[pos];
+    }
+
+    /**
+     * add id to all extracts in the set code
+     */
+    void add(const osmium::object_id_type id, code_type code) {
+        if (code == extract_masks::none) return;
+
+        const code_type current = get(id);
+        const code_type merged = m_masks.merge(current, code);
+        if (merged == current) return;
+
+        if (merged > 0xff && m_code_bytes == 1) {
+            widen();
+        }
+
+        unsigned char* bytes = find_segment(id / ids_per_segment());
+        const size_t pos = id % ids_per_segment();
+        if (m_code_bytes == 1) {
+            bytes[pos] = static_cast<unsigned char>(merged);
+        } else {
+            reinterpret_cast<uint16_t*>(bytes)[pos] = merged;
+        }
+    }
+
+}; // class extract_membership
+
+#endif // EXTRACT_MEMBERSHIP_HPP
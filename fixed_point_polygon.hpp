@@ -0,0 +1,312 @@
+#ifndef FIXED_POINT_POLYGON_HPP
+#define FIXED_POINT_POLYGON_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <geos/geom/Coordinate.h>
+#include <geos/geom/CoordinateSequence.h>
+#include <geos/geom/Geometry.h>
+#include <geos/geom/LineString.h>
+#include <geos/geom/Polygon.h>
+
+#include "cpu_features.hpp"
+
+/**
+ * A copy of an extract polygon in osmiums fixed point coordinates, tested
+ * with an even-odd crossing test directly on the integer x()/y() of a
+ * location. Nothing is allocated per test and concurrent tests are safe.
+ *
+ * The edges are sorted into horizontal bands, so a test only looks at the
+ * edges spanning the band of the point. The crossing test is exact integer
+ * arithmetic. Only points lying exactly on an edge may come out either
+ * way, GEOS doesn't count those as contained either.
+ *
+ * On CPUs with AVX2 four edges are tested at once, computing the crossing
+ * in double with a precomputed slope. Where that lands within one unit of
+ * the point the edge is tested again exactly, so both paths always agree.
+ */
+class fixed_point_polygon {
+
+public:
+
+    // a ring edge with y1 <= y2
+    struct edge {
+        int32_t x1;
+        int32_t y1;
+        int32_t x2;
+        int32_t y2;
+    };
+
+private:
+
+    // osmium stores coordinates as degrees * 10^7
+    static constexpr double precision = 10000000.0;
+
+    int32_t m_min_x;
+    int32_t m_min_y;
+    int32_t m_max_x;
+    int32_t m_max_y;
+
+    std::vector<edge> m_edges;
+
+    // height of the bands in fixed point units
+    int64_t m_band_height;
+
+    // each band is a run of edge copies split into separate arrays, padded
+    // to a multiple of four with edges that never cross. band b is
+    // [m_band_begin[b], m_band_begin[b+1]). horizontal edges are left out,
+    // they never cross a ray.
+    std::vector<uint32_t> m_band_begin;
+    std::vector<int32_t> m_band_x1;
+    std::vector<int32_t> m_band_y1;
+    std::vector<int32_t> m_band_x2;
+    std::vector<int32_t> m_band_y2;
+    std::vector<double> m_band_slope;
+
+    static const size_t lanes = 4;
+
+    // geometry_cache fills in a default constructed polygon
+    friend class geometry_cache;
+
+    fixed_point_polygon() :
+        m_min_x(1),
+        m_min_y(1),
+        m_max_x(0),
+        m_max_y(0),
+        m_edges(),
+        m_band_height(1),
+        m_band_begin(),
+        m_band_x1(),
+        m_band_y1(),
+        m_band_x2(),
+        m_band_y2(),
+        m_band_slope() {
+    }
+
+    static int32_t to_fixed(double c) {
+        return static_cast<int32_t>(std::round(c * precision));
+    }
+
+    void add_ring(const geos::geom::CoordinateSequence& ring) {
+        for (size_t i = 1; i < ring.getSize(); i++) {
+            edge e = {
+                to_fixed(ring.getAt(i-1).x), to_fixed(ring.getAt(i-1).y),
+                to_fixed(ring.getAt(i).x), to_fixed(ring.getAt(i).y)
+            };
+            if (e.x1 == e.x2 && e.y1 == e.y2) continue;
+
+            if (e.y1 > e.y2) {
+                std::swap(e.x1, e.x2);
+                std::swap(e.y1, e.y2);
+            }
+
+            m_min_x = std::min(m_min_x, std::min(e.x1, e.x2));
+            m_max_x = std::max(m_max_x, std::max(e.x1, e.x2));
+            m_min_y = std::min(m_min_y, e.y1);
+            m_max_y = std::max(m_max_y, e.y2);
+            m_edges.push_back(e);
+        }
+    }
+
+    void add_polygon(const geos::geom::Polygon& polygon) {
+        add_ring(*polygon.getExteriorRing()->getCoordinatesRO());
+        for (size_t i = 0; i < polygon.getNumInteriorRing(); i++) {
+            add_ring(*polygon.getInteriorRingN(i)->getCoordinatesRO());
+        }
+    }
+
+    size_t band(int32_t y) const {
+        return static_cast<size_t>((static_cast<int64_t>(y) - m_min_y) / m_band_height);
+    }
+
+    void build_bands() {
+        // about two edges per band, the longest edges span many bands
+        const size_t bands = std::max<size_t>(1, std::min<size_t>(m_edges.size() / 2, 65536));
+        m_band_height = std::max<int64_t>(1, (static_cast<int64_t>(m_max_y) - m_min_y + bands) / bands);
+
+        std::vector<uint32_t> count(bands, 0);
+        for (const auto& e : m_edges) {
+            if (e.y1 == e.y2) continue;
+            for (size_t b = band(e.y1); b <= band(e.y2); b++) {
+                count[b]++;
+            }
+        }
+
+        m_band_begin.assign(bands + 1, 0);
+        for (size_t b = 0; b < bands; b++) {
+            m_band_begin[b+1] = m_band_begin[b] + (count[b] + lanes - 1) / lanes * lanes;
+        }
+
+        // padding edges have y1 == y2, so y1 <= y < y2 never holds
+        const size_t size = m_band_begin[bands];
+        m_band_x1.assign(size, 0);
+        m_band_y1.assign(size, 0);
+        m_band_x2.assign(size, 0);
+        m_band_y2.assign(size, 0);
+        m_band_slope.assign(size, 0.0);
+
+        std::vector<uint32_t> fill(m_band_begin.begin(), m_band_begin.end() - 1);
+        for (const auto& e : m_edges) {
+            if (e.y1 == e.y2) continue;
+            const double slope = (static_cast<double>(e.x2) - e.x1) / (static_cast<double>(e.y2) - e.y1);
+            for (size_t b = band(e.y1); b <= band(e.y2); b++) {
+                const uint32_t i = fill[b]++;
+                m_band_x1[i] = e.x1;
+                m_band_y1[i] = e.y1;
+                m_band_x2[i] = e.x2;
+                m_band_y2[i] = e.y2;
+                m_band_slope[i] = slope;
+            }
+        }
+    }
+
+    // the edge crosses the horizontal through y and the crossing lies right
+    // of x. products of two coordinate differences always fit into 64 bits.
+    bool crosses(uint32_t i, int32_t x, int32_t y) const {
+        return m_band_y1[i] <= y && y < m_band_y2[i] &&
+            (static_cast<int64_t>(x) - m_band_x1[i]) * (static_cast<int64_t>(m_band_y2[i]) - m_band_y1[i]) <
+            (static_cast<int64_t>(y) - m_band_y1[i]) * (static_cast<int64_t>(m_band_x2[i]) - m_band_x1[i]);
+    }
+
+    bool contains_scalar(size_t b, int32_t x, int32_t y) const {
+        bool inside = false;
+        for (uint32_t i = m_band_begin[b]; i < m_band_begin[b+1]; i++) {
+            if (crosses(i, x, y)) {
+                inside = !inside;
+            }
+        }
+        return inside;
+    }
+
+#ifdef SPLITTER_HAVE_X86_KERNELS
+    __attribute__((target("avx2")))
+    bool contains_avx2(size_t b, int32_t x, int32_t y) const {
+        const __m128i vy = _mm_set1_epi32(y);
+        const __m256d dx = _mm256_set1_pd(x);
+        const __m256d dy = _mm256_set1_pd(y);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+
+        unsigned int crossings = 0;
+        for (uint32_t i = m_band_begin[b]; i < m_band_begin[b+1]; i += lanes) {
+            const __m128i y1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_band_y1[i]));
+            const __m128i y2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_band_y2[i]));
+
+            // y1 <= y < y2
+            const __m128i spans = _mm_andnot_si128(_mm_cmpgt_epi32(y1, vy), _mm_cmpgt_epi32(y2, vy));
+            const unsigned int spanning = _mm_movemask_ps(_mm_castsi128_ps(spans));
+            if (!spanning) continue;
+
+            const __m256d x1 = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_band_x1[i])));
+            const __m256d slope = _mm256_loadu_pd(&m_band_slope[i]);
+            const __m256d crossing = _mm256_add_pd(x1, _mm256_mul_pd(_mm256_sub_pd(dy, _mm256_cvtepi32_pd(y1)), slope));
+
+            const unsigned int left = _mm256_movemask_pd(_mm256_cmp_pd(dx, crossing, _CMP_LT_OQ));
+            const unsigned int close = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(_mm256_sub_pd(dx, crossing), abs_mask), one, _CMP_LT_OQ));
+
+            crossings += __builtin_popcount(spanning & left & ~close);
+
+            unsigned int exact = spanning & close;
+            while (exact) {
+                crossings += crosses(i + __builtin_ctz(exact), x, y);
+                exact &= exact - 1;
+            }
+        }
+
+        return crossings & 1;
+    }
+#endif
+
+public:
+
+    /**
+     * copy polygon, which may be a Polygon or a MultiPolygon
+     */
+    explicit fixed_point_polygon(const geos::geom::Geometry& polygon) :
+        m_min_x(std::numeric_limits<int32_t>::max()),
+        m_min_y(std::numeric_limits<int32_t>::max()),
+        m_max_x(std::numeric_limits<int32_t>::min()),
+        m_max_y(std::numeric_limits<int32_t>::min()),
+        m_edges(),
+        m_band_height(1),
+        m_band_begin(),
+        m_band_x1(),
+        m_band_y1(),
+        m_band_x2(),
+        m_band_y2(),
+        m_band_slope() {
+        for (size_t i = 0; i < polygon.getNumGeometries(); i++) {
+            const geos::geom::Polygon* part = dynamic_cast<const geos::geom::Polygon*>(polygon.getGeometryN(i));
+            if (part) {
+                add_polygon(*part);
+            }
+        }
+
+        if (m_edges.empty()) {
+            m_min_x = m_min_y = 1;
+            m_max_x = m_max_y = 0;
+            return;
+        }
+
+        build_bands();
+    }
+
+    /**
+     * cut edge e into pieces no longer than half of step in either
+     * direction and call func(min_x, min_y, max_x, max_y) with the bounding
+     * box of every piece. on a grid of cells step wide, each box covers at
+     * most two cells in either direction.
+     */
+    template <typename TFunc>
+    static void split_edge(const edge& e, int64_t step, TFunc func) {
+        const int64_t dx = static_cast<int64_t>(e.x2) - e.x1;
+        const int64_t dy = static_cast<int64_t>(e.y2) - e.y1;
+        const int64_t pieces = std::max<int64_t>(1, 2 * std::max(std::abs(dx), std::abs(dy)) / step + 1);
+
+        int64_t px = e.x1;
+        int64_t py = e.y1;
+        for (int64_t p = 1; p <= pieces; p++) {
+            const double t = static_cast<double>(p) / pieces;
+            const int64_t qx = e.x1 + std::llround(dx * t);
+            const int64_t qy = e.y1 + std::llround(dy * t);
+
+            func(std::min(px, qx), std::min(py, qy), std::max(px, qx), std::max(py, qy));
+            px = qx;
+            py = qy;
+        }
+    }
+
+    int32_t min_x() const { return m_min_x; }
+    int32_t min_y() const { return m_min_y; }
+    int32_t max_x() const { return m_max_x; }
+    int32_t max_y() const { return m_max_y; }
+
+    const std::vector<edge>& edges() const {
+        return m_edges;
+    }
+
+    /**
+     * is the point given in osmium fixed point coordinates inside?
+     * undefined locations are never inside.
+     */
+    bool contains(int32_t x, int32_t y) const {
+        if (x < m_min_x || x > m_max_x || y < m_min_y || y > m_max_y) {
+            return false;
+        }
+
+        const size_t b = band(y);
+#ifdef SPLITTER_HAVE_X86_KERNELS
+        if (cpu_has_avx2()) {
+            return contains_avx2(b, x, y);
+        }
+#endif
+        return contains_scalar(b, x, y);
+    }
+
+}; // class fixed_point_polygon
+
+#endif // FIXED_POINT_POLYGON_HPP
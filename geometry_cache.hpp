@@ -0,0 +1,359 @@
+#ifndef GEOMETRY_CACHE_HPP
+#define GEOMETRY_CACHE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fixed_point_polygon.hpp"
+#include "polygon_raster.hpp"
+
+/**
+ * Keeps the prepared form of extract polygons on disk between runs.
+ *
+ * Reading a .poly or .osm file, building the GEOS geometry and preparing
+ * the fixed_point_polygon and polygon_raster from it costs noticeable time
+ * for big polygons. The result is stored in the cache directory under the
+ * FNV-1a hash of the clipping file's contents, so an unchanged file is
+ * loaded by mapping one file and copying out its arrays. A changed file
+ * gets a new hash and is simply prepared again.
+ *
+ * Without a directory set the cache does nothing.
+ */
+class geometry_cache {
+
+    // bump when the layout of the cached classes changes
+    static const uint32_t format_version = 1;
+
+    struct header {
+        char magic[8]; // "OHSGEOM\0"
+        uint32_t version;
+        uint32_t type;
+        uint64_t size;
+        uint64_t hash;
+    };
+
+    std::string m_directory;
+
+    // permissions for new cache files
+    mode_t m_file_mode;
+
+    geometry_cache() :
+        m_directory(),
+        m_file_mode(0644) {
+    }
+
+    static uint64_t fnv1a(const std::string& data) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static bool read_file(const std::string& path, std::string& data) {
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (!fp) {
+            return false;
+        }
+
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+            data.append(buffer, n);
+        }
+        const bool ok = !ferror(fp);
+        fclose(fp);
+        return ok;
+    }
+
+    template <typename T>
+    static void put(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void put(std::string& out, const std::vector<T>& values) {
+        put(out, static_cast<uint64_t>(values.size()));
+        out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    // reads values back from a mapped cache file, refusing to read past
+    // its end
+    class cursor {
+
+        const char* m_pos;
+        const char* m_end;
+
+    public:
+
+        cursor(const char* begin, const char* end) :
+            m_pos(begin),
+            m_end(end) {
+        }
+
+        template <typename T>
+        bool get(T& value) {
+            if (static_cast<size_t>(m_end - m_pos) < sizeof(T)) {
+                return false;
+            }
+            memcpy(&value, m_pos, sizeof(T));
+            m_pos += sizeof(T);
+            return true;
+        }
+
+        template <typename T>
+        bool get(std::vector<T>& values) {
+            uint64_t count;
+            if (!get(count) || count > static_cast<size_t>(m_end - m_pos) / sizeof(T)) {
+                return false;
+            }
+            values.resize(count);
+            memcpy(values.data(), m_pos, count * sizeof(T));
+            m_pos += count * sizeof(T);
+            return true;
+        }
+
+        bool at_end() const {
+            return m_pos == m_end;
+        }
+
+    };
+
+    std::string cache_path(uint64_t hash, char type) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx-%c.geom", static_cast<unsigned long long>(hash), type);
+        return m_directory + name;
+    }
+
+    // the edges of every band lie within the edge arrays, so a damaged
+    // file can't make contains() read past them
+    static bool valid_band_begin(const std::vector<uint32_t>& band_begin, size_t size) {
+        for (size_t b = 0; b < band_begin.size(); b++) {
+            if (band_begin[b] > size || (b > 0 && band_begin[b] < band_begin[b-1])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool valid_bands(const fixed_point_polygon& polygon) {
+        const size_t size = polygon.m_band_x1.size();
+        return
+            polygon.m_band_begin.size() >= 2 &&
+            valid_band_begin(polygon.m_band_begin, size) &&
+            polygon.m_min_y <= polygon.m_max_y &&
+            (static_cast<int64_t>(polygon.m_max_y) - polygon.m_min_y) / polygon.m_band_height < static_cast<int64_t>(polygon.m_band_begin.size() - 1) &&
+            polygon.m_band_begin.back() == size &&
+            polygon.m_band_y1.size() == size && polygon.m_band_x2.size() == size &&
+            polygon.m_band_y2.size() == size && polygon.m_band_slope.size() == size;
+    }
+
+    static bool parse(cursor& in, fixed_point_polygon& polygon, polygon_raster& raster) {
+        return
+            in.get(polygon.m_min_x) && in.get(polygon.m_min_y) &&
+            in.get(polygon.m_max_x) && in.get(polygon.m_max_y) &&
+            in.get(polygon.m_edges) &&
+            in.get(polygon.m_band_height) &&
+            in.get(polygon.m_band_begin) &&
+            in.get(polygon.m_band_x1) && in.get(polygon.m_band_y1) &&
+            in.get(polygon.m_band_x2) && in.get(polygon.m_band_y2) &&
+            in.get(polygon.m_band_slope) &&
+            in.get(raster.m_x0) && in.get(raster.m_y0) &&
+            in.get(raster.m_cell_size) &&
+            in.get(raster.m_columns) && in.get(raster.m_rows) &&
+            in.get(raster.m_cells) &&
+            in.at_end() &&
+            polygon.m_band_height > 0 &&
+            (polygon.m_edges.empty() || valid_bands(polygon)) &&
+            raster.m_cell_size > 0 &&
+            valid_raster(polygon, raster);
+    }
+
+    // an empty polygon gets an empty 0x0 raster
+    static bool valid_raster(const fixed_point_polygon& polygon, const polygon_raster& raster) {
+        if (polygon.m_edges.empty() && raster.m_cells.empty()) {
+            return raster.m_columns == 0 && raster.m_rows == 0;
+        }
+        return
+            raster.m_columns > 0 && raster.m_rows > 0 &&
+            raster.m_cells.size() % raster.m_columns == 0 &&
+            raster.m_cells.size() / raster.m_columns == static_cast<size_t>(raster.m_rows);
+    }
+
+public:
+
+    static geometry_cache& instance() {
+        static geometry_cache cache;
+        return cache;
+    }
+
+    /**
+     * keep prepared geometries in directory. returns false if it can't be
+     * used.
+     */
+    bool set_directory(const std::string& directory) {
+        struct stat st;
+        if (stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            std::cerr << "geometry cache directory " << directory << " does not exist\n";
+            return false;
+        }
+        m_directory = directory;
+
+        // mkstemp creates files readable by the owner only, cache files get
+        // the permissions fopen would have given them. there is no way to
+        // read the umask without setting it, this runs before any threads.
+        const mode_t mask = umask(0);
+        umask(mask);
+        m_file_mode = 0666 & ~mask;
+        return true;
+    }
+
+    bool enabled() const {
+        return !m_directory.empty();
+    }
+
+    /**
+     * load the prepared geometry of the clipping file path of the given
+     * type ('p' for POLY, 'o' for OSM). returns false if it isn't cached,
+     * the caller then builds it and hands it to store().
+     */
+    bool load(const std::string& path, char type, fixed_point_polygon*& polygon, polygon_raster*& raster) const {
+        if (!enabled()) {
+            return false;
+        }
+
+        std::string data;
+        if (!read_file(path, data)) {
+            return false;
+        }
+        const uint64_t hash = fnv1a(data);
+
+        const std::string file = cache_path(hash, type);
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header)) {
+            close(fd);
+            return false;
+        }
+
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+
+        const char* begin = static_cast<const char*>(map);
+        header h;
+        memcpy(&h, begin, sizeof(h));
+
+        bool ok = false;
+        std::unique_ptr<fixed_point_polygon> p(new fixed_point_polygon());
+        std::unique_ptr<polygon_raster> r(new polygon_raster());
+        if (memcmp(h.magic, "OHSGEOM", sizeof(h.magic)) == 0 && h.version == format_version &&
+            h.type == static_cast<uint32_t>(type) && h.size == data.size() && h.hash == hash) {
+            cursor in(begin + sizeof(header), begin + st.st_size);
+            ok = parse(in, *p, *r);
+        }
+        munmap(map, st.st_size);
+
+        if (!ok) {
+            std::cerr << "ignoring damaged geometry cache file " << file << "\n";
+            return false;
+        }
+
+        polygon = p.release();
+        raster = r.release();
+        return true;
+    }
+
+    /**
+     * store the prepared geometry of the clipping file path. failing to
+     * write the cache is reported but otherwise harmless.
+     */
+    void store(const std::string& path, char type, const fixed_point_polygon& polygon, const polygon_raster& raster) const {
+        if (!enabled()) {
+            return;
+        }
+
+        std::string data;
+        if (!read_file(path, data)) {
+            return;
+        }
+
+        header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "OHSGEOM", sizeof(h.magic));
+        h.version = format_version;
+        h.type = static_cast<uint32_t>(type);
+        h.size = data.size();
+        h.hash = fnv1a(data);
+
+        std::string out;
+        put(out, h);
+        put(out, polygon.m_min_x);
+        put(out, polygon.m_min_y);
+        put(out, polygon.m_max_x);
+        put(out, polygon.m_max_y);
+        put(out, polygon.m_edges);
+        put(out, polygon.m_band_height);
+        put(out, polygon.m_band_begin);
+        put(out, polygon.m_band_x1);
+        put(out, polygon.m_band_y1);
+        put(out, polygon.m_band_x2);
+        put(out, polygon.m_band_y2);
+        put(out, polygon.m_band_slope);
+        put(out, raster.m_x0);
+        put(out, raster.m_y0);
+        put(out, raster.m_cell_size);
+        put(out, raster.m_columns);
+        put(out, raster.m_rows);
+        put(out, raster.m_cells);
+
+        // write under a unique temporary name and rename, so concurrent
+        // runs never see a half written file, and threads storing the same
+        // clip file at once don't write to the same temp file
+        const std::string file = cache_path(h.hash, type);
+        std::vector<char> tmpl(file.begin(), file.end());
+        const char suffix[] = ".XXXXXX";
+        tmpl.insert(tmpl.end(), suffix, suffix + sizeof(suffix));
+        const int fd = mkstemp(tmpl.data());
+        if (fd < 0) {
+            std::cerr << "unable to write geometry cache file " << file << ": " << strerror(errno) << "\n";
+            return;
+        }
+        const std::string tmp(tmpl.data());
+
+        FILE *fp = fchmod(fd, m_file_mode) == 0 ? fdopen(fd, "wb") : nullptr;
+        if (!fp) {
+            std::cerr << "unable to write geometry cache file " << tmp << ": " << strerror(errno) << "\n";
+            close(fd);
+            unlink(tmp.c_str());
+            return;
+        }
+        const bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+        if (fclose(fp) != 0 || !written || rename(tmp.c_str(), file.c_str()) != 0) {
+            std::cerr << "unable to write geometry cache file " << file << ": " << strerror(errno) << "\n";
+            unlink(tmp.c_str());
+        }
+    }
+
+}; // class geometry_cache
+
+#endif // GEOMETRY_CACHE_HPP
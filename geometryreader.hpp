@@ -1,7 +1,15 @@
 #ifndef OSMIUMEX_GEOMBUILDER_HPP
 #define OSMIUMEX_GEOMBUILDER_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <geos/geom/Coordinate.h>
 #include <geos/geom/CoordinateSequence.h>
@@ -15,98 +23,316 @@
 #include <geos/util/GEOSException.h>
 
 #include <osmium/handler.hpp>
-#include <osmium/handler/node_locations_for_ways.hpp>
-#include <osmium/index/map/dense_mem_array.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/io/reader.hpp>
 #include <osmium/visitor.hpp>
 
-
-typedef osmium::index::map::DenseMemArray<osmium::unsigned_object_id_type, osmium::Location> storage_array_t;
-typedef osmium::handler::NodeLocationsForWays<storage_array_t, storage_array_t> cfw_handler_t;
-
 namespace OsmiumExtension {
 
+    // every thread gets its own factory, GEOS keeps count of the
+    // geometries created by a factory without any locking. geometries have
+    // to be destroyed on the thread that created them.
     geos::geom::GeometryFactory* geos_factory() {
         static std::unique_ptr<const geos::geom::PrecisionModel> precision_model{new geos::geom::PrecisionModel};
-        static std::unique_ptr<geos::geom::GeometryFactory> factory{new geos::geom::GeometryFactory(precision_model.get(), -1)};
+        static thread_local std::unique_ptr<geos::geom::GeometryFactory> factory{new geos::geom::GeometryFactory(precision_model.get(), -1)};
         return factory.get();
     }
 
+    /// coordinates of a closed ring
+    typedef std::vector<geos::geom::Coordinate> ring_t;
+
+    /// geometries that are destroyed unless they were released
+    class geometry_list {
+
+        std::unique_ptr<std::vector<geos::geom::Geometry*>> m_geometries;
+
+    public:
+
+        geometry_list() :
+            m_geometries(new std::vector<geos::geom::Geometry*>()) {
+        }
+
+        ~geometry_list() {
+            if (m_geometries) {
+                for (const auto geometry : *m_geometries) {
+                    geos_factory()->destroyGeometry(geometry);
+                }
+            }
+        }
+
+        void push_back(geos::geom::Geometry* geometry) {
+            m_geometries->push_back(geometry);
+        }
+
+        std::vector<geos::geom::Geometry*>* release() {
+            return m_geometries.release();
+        }
+
+    };
+
+    /// even-odd test of point p against a closed ring
+    bool ringContains(const ring_t& ring, const geos::geom::Coordinate& p) {
+        bool inside = false;
+        for (size_t i = 1; i < ring.size(); i++) {
+            const geos::geom::Coordinate& a = ring[i-1];
+            const geos::geom::Coordinate& b = ring[i];
+            if ((a.y > p.y) != (b.y > p.y) && p.x < a.x + (p.y - a.y) * (b.x - a.x) / (b.y - a.y)) {
+                inside = !inside;
+            }
+        }
+        return inside;
+    }
+
+    /// area enclosed by a closed ring
+    double ringArea(const ring_t& ring) {
+        double area = 0;
+        for (size_t i = 1; i < ring.size(); i++) {
+            area += ring[i-1].x * ring[i].y - ring[i].x * ring[i-1].y;
+        }
+        return std::abs(area) / 2;
+    }
+
+    /**
+     * build a MultiPolygon from outer and inner rings. every inner ring
+     * becomes a hole of the smallest outer ring around it, so islands in
+     * lakes in islands come out right. inner rings outside of all outer
+     * rings are dropped.
+     *
+     * nodes are tested against all rings with the even-odd rule anyway,
+     * the holes are assigned so the geometry is a valid one.
+     *
+     * returns nullptr if GEOS refuses the rings.
+     */
+    geos::geom::Geometry *buildPolygons(std::vector<ring_t>& outer, std::vector<ring_t>& inner) {
+        std::vector<double> areas;
+        for (const auto& ring : outer) {
+            areas.push_back(ringArea(ring));
+        }
+
+        std::vector<std::vector<size_t>> holes(outer.size());
+        for (size_t i = 0; i < inner.size(); i++) {
+            if (inner[i].empty()) continue;
+
+            size_t shell = outer.size();
+            for (size_t o = 0; o < outer.size(); o++) {
+                if ((shell == outer.size() || areas[o] < areas[shell]) && ringContains(outer[o], inner[i].front())) {
+                    shell = o;
+                }
+            }
+
+            if (shell == outer.size()) {
+                std::cerr << "dropping inner ring outside of all outer rings\n";
+                continue;
+            }
+            holes[shell].push_back(i);
+        }
+
+        try {
+            geometry_list polygons;
+            for (size_t o = 0; o < outer.size(); o++) {
+                std::vector<geos::geom::Geometry*> *rings = new std::vector<geos::geom::Geometry*>();
+                for (const size_t i : holes[o]) {
+                    rings->push_back(geos_factory()->createLinearRing(
+                        geos_factory()->getCoordinateSequenceFactory()->create(new ring_t(std::move(inner[i])))
+                    ));
+                }
+
+                polygons.push_back(geos_factory()->createPolygon(
+                    geos_factory()->createLinearRing(
+                        geos_factory()->getCoordinateSequenceFactory()->create(new ring_t(std::move(outer[o])))
+                    ),
+                    rings
+                ));
+            }
+            return geos_factory()->createMultiPolygon(polygons.release());
+        } catch(geos::util::GEOSException e) {
+            std::cerr << "error creating multipolygon: " << e.what() << "\n";
+            return nullptr;
+        }
+    }
+
+    /**
+     * collects the areas in a small .osm file: every closed way not used
+     * by a relation, and every multipolygon or boundary relation assembled
+     * from its member ways.
+     *
+     * clip files contain real OSM ids, so node locations are kept in a
+     * flat vector sorted by id instead of an array indexed by id. it only
+     * grows with the number of nodes in the file, not with their ids.
+     * ways are resolved after the whole file was read, so the order of the
+     * objects in the file doesn't matter.
+     */
     class OsmGeometryReader : public osmium::handler::Handler {
-        std::vector<geos::geom::Geometry*> outer;
-        storage_array_t store_pos;
-        storage_array_t store_neg;
-        cfw_handler_t* handler_cfw;
-
-    private:
-            geos::geom::Geometry *polygonFromWay(const osmium::Way& way) const {
-                if (!way.is_closed()) {
-                    std::cerr << "can't build way polygon geometry of unclosed way, leave it as nullptr\n";
-                    return nullptr;
+
+        typedef std::vector<osmium::object_id_type> node_ids_t;
+
+        struct member_way {
+            osmium::object_id_type id;
+            bool inner;
+        };
+
+        std::vector<std::pair<osmium::object_id_type, osmium::Location>> m_locations;
+        std::vector<std::pair<osmium::object_id_type, node_ids_t>> m_ways;
+        // the member ways of every area relation
+        std::vector<std::vector<member_way>> m_relations;
+
+        template <typename TVector>
+        static void sort_by_id(TVector& v) {
+            std::sort(v.begin(), v.end(), [](const typename TVector::value_type& a, const typename TVector::value_type& b) {
+                return a.first < b.first;
+            });
+        }
+
+        template <typename TVector>
+        static const typename TVector::value_type* find_by_id(const TVector& v, osmium::object_id_type id) {
+            const auto it = std::lower_bound(v.begin(), v.end(), id, [](const typename TVector::value_type& a, osmium::object_id_type id) {
+                return a.first < id;
+            });
+            return (it != v.end() && it->first == id) ? &*it : nullptr;
+        }
+
+        // look up the locations of the nodes of a closed ring
+        bool resolve(const node_ids_t& nodes, ring_t& ring) const {
+            for (const auto id : nodes) {
+                const auto location = find_by_id(m_locations, id);
+                if (!location || !location->second.valid()) {
+                    std::cerr << "node " << id << " of a ring is missing in osm-input\n";
+                    return false;
                 }
-                try {
-                    std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>;
+                ring.emplace_back(location->second.lon(), location->second.lat());
+            }
+            return true;
+        }
+
+        // join ways into closed rings where their end nodes meet
+        void assemble(const std::vector<const node_ids_t*>& ways, std::vector<ring_t>& rings) const {
+            std::multimap<osmium::object_id_type, size_t> ends;
+            for (size_t w = 0; w < ways.size(); w++) {
+                ends.emplace(ways[w]->front(), w);
+                ends.emplace(ways[w]->back(), w);
+            }
 
-                    for (const auto& node_ref : way.nodes()) {
-                        c->emplace_back(node_ref.location().lon(), node_ref.location().lat());
+            std::vector<bool> used(ways.size(), false);
+            for (size_t w = 0; w < ways.size(); w++) {
+                if (used[w]) continue;
+                used[w] = true;
+                node_ids_t nodes(*ways[w]);
+
+                while (nodes.front() != nodes.back()) {
+                    const auto range = ends.equal_range(nodes.back());
+                    auto it = range.first;
+                    while (it != range.second && used[it->second]) {
+                        ++it;
+                    }
+                    if (it == range.second) {
+                        break;
                     }
 
-                    geos::geom::CoordinateSequence *cs = geos_factory()->getCoordinateSequenceFactory()->create(c);
-                    geos::geom::LinearRing *ring = geos_factory()->createLinearRing(cs);
-                    return static_cast<geos::geom::Geometry *>(geos_factory()->createPolygon(ring, nullptr));
-                } catch (const geos::util::GEOSException& exc) {
-                    std::cerr << "error building way geometry, leave it as nullptr\n";
-                    return nullptr;
+                    const node_ids_t& next = *ways[it->second];
+                    used[it->second] = true;
+                    if (next.front() == nodes.back()) {
+                        nodes.insert(nodes.end(), next.begin() + 1, next.end());
+                    } else {
+                        nodes.insert(nodes.end(), next.rbegin() + 1, next.rend());
+                    }
+                }
+
+                if (nodes.front() != nodes.back()) {
+                    std::cerr << "unclosed ring starting at node " << nodes.front() << " in osm-input\n";
+                    continue;
+                }
+
+                ring_t ring;
+                if (resolve(nodes, ring)) {
+                    rings.push_back(std::move(ring));
                 }
             }
+        }
 
     public:
+
         OsmGeometryReader() :
             Handler(),
-            store_pos(5000),
-            store_neg(1000) {
-            handler_cfw = new cfw_handler_t(store_pos, store_neg);
+            m_locations(),
+            m_ways(),
+            m_relations() {
         }
 
-        virtual ~OsmGeometryReader() {
-            delete handler_cfw;
+        void node(const osmium::Node& node) {
+            m_locations.emplace_back(node.id(), node.location());
+        }
 
-            for (uint32_t i=0; i < outer.size(); i++) {
-                geos_factory()->destroyGeometry(outer[i]);
+        void way(const osmium::Way& way) {
+            if (way.nodes().size() < 2) {
+                return;
             }
-            outer.clear();
-        }
 
-        void node(const osmium::Node& node) {
-            handler_cfw->node(node);
+            node_ids_t nodes;
+            for (const auto& node_ref : way.nodes()) {
+                nodes.push_back(node_ref.ref());
+            }
+            m_ways.emplace_back(way.id(), std::move(nodes));
         }
 
-        void way(osmium::Way& way) {
-            handler_cfw->way(way);
-
-            if (!way.is_closed()) {
-                std::cerr << "open way " << way.id() << " in osm-input\n";
+        void relation(const osmium::Relation& relation) {
+            const char* type = relation.tags().get_value_by_key("type");
+            if (!type || (strcmp(type, "multipolygon") && strcmp(type, "boundary"))) {
                 return;
             }
 
-            geos::geom::Geometry *geom = polygonFromWay(way);
-            if (!geom) {
-                std::cerr << "error creating polygon from way\n";
-                return;
+            m_relations.emplace_back();
+            for (const auto& member : relation.members()) {
+                if (member.type() == osmium::item_type::way) {
+                    m_relations.back().push_back(member_way { member.ref(), !strcmp(member.role(), "inner") });
+                }
             }
-            outer.push_back(geom);
         }
 
-        geos::geom::Geometry *buildGeom() const {
-            geos::geom::MultiPolygon *outerPoly;
-            try {
-                outerPoly = geos_factory()->createMultiPolygon(outer);
-            } catch(geos::util::GEOSException e) {
-                std::cerr << "error creating multipolygon: " << e.what() << "\n";
-                return nullptr;
+        geos::geom::Geometry *buildGeom() {
+            sort_by_id(m_locations);
+            sort_by_id(m_ways);
+
+            std::vector<ring_t> outer;
+            std::vector<ring_t> inner;
+
+            // relations are assembled one by one, neighbouring areas share
+            // the ways along their common border
+            std::vector<osmium::object_id_type> in_relation;
+            for (const auto& members : m_relations) {
+                std::vector<const node_ids_t*> outer_ways;
+                std::vector<const node_ids_t*> inner_ways;
+                for (const auto& member : members) {
+                    const auto way = find_by_id(m_ways, member.id);
+                    if (!way) {
+                        std::cerr << "member way " << member.id << " is missing in osm-input\n";
+                        continue;
+                    }
+                    (member.inner ? inner_ways : outer_ways).push_back(&way->second);
+                    in_relation.push_back(member.id);
+                }
+
+                assemble(outer_ways, outer);
+                assemble(inner_ways, inner);
             }
-            return outerPoly;
+            std::sort(in_relation.begin(), in_relation.end());
+
+            for (const auto& way : m_ways) {
+                if (std::binary_search(in_relation.begin(), in_relation.end(), way.first)) {
+                    continue;
+                }
+
+                if (way.second.front() != way.second.back()) {
+                    std::cerr << "open way " << way.first << " in osm-input\n";
+                    continue;
+                }
+
+                ring_t ring;
+                if (resolve(way.second, ring)) {
+                    outer.push_back(std::move(ring));
+                }
+            }
+
+            return buildPolygons(outer, inner);
         }
     };
 
@@ -115,6 +341,19 @@ namespace OsmiumExtension {
         /// maximum length of a line in a .poly file
         static const int polyfile_linelen = 2048;
 
+        /// parse the two numbers of a coordinate line in a .poly file
+        static bool parse_coordinates(const char* line, double& x, double& y) {
+            char* end;
+            x = strtod(line, &end);
+            if (end == line) {
+                return false;
+            }
+
+            const char* next = end;
+            y = strtod(next, &end);
+            return end != next;
+        }
+
     public:
 
         /**
@@ -128,23 +367,22 @@ namespace OsmiumExtension {
          *     - END token
          *   - END token
          *
-         * usually the Geometry read from .poly files are used together with an
-         * geos::algorithm::locate::IndexedPointInAreaLocator to check for nodes
-         * being located inside the polygon.
+         * every inner polygon becomes a hole of the outer polygon around it,
+         * see buildPolygons().
          *
          * this method returns nullptr if the .poly file can't be read.
          */
         static geos::geom::Geometry *fromPolyFile(const std::string &file) {
 
-            // pointer to coordinate vector
-            std::vector<geos::geom::Coordinate> *c = nullptr;
+            // outer and inner rings
+            std::vector<ring_t> outer;
+            std::vector<ring_t> inner;
 
-            // vectors of outer and inner polygons
-            std::vector<geos::geom::Geometry*> *outer = new std::vector<geos::geom::Geometry*>();
-            std::vector<geos::geom::Geometry*> *inner = new std::vector<geos::geom::Geometry*>();
+            // coordinates of the ring currently being read
+            ring_t *c = nullptr;
 
-            // file pointer to .poly file
-            FILE *fp = fopen(file.c_str(), "r");
+            // file pointer to .poly file, closed on every way out
+            std::unique_ptr<FILE, int(*)(FILE*)> fp(fopen(file.c_str(), "r"), fclose);
             if (!fp) {
                 std::cerr << "unable to open polygon file " << file << "\n";
                 return nullptr;
@@ -154,7 +392,7 @@ namespace OsmiumExtension {
             char line[polyfile_linelen];
 
             // read title line
-            if (!fgets(line, polyfile_linelen-1, fp)) {
+            if (!fgets(line, polyfile_linelen-1, fp.get())) {
                 std::cerr << "unable to read title line from polygon file " << file << "\n";
                 return nullptr;
             }
@@ -166,13 +404,10 @@ namespace OsmiumExtension {
             // are we currently inside parsing one polygon
             bool ispoly = false;
 
-            // double x / y coords
-            double x = 0, y = 0;
-
             // read through the file
-            while (!feof(fp)) {
+            while (!feof(fp.get())) {
                 // read a line
-                if (!fgets(line, polyfile_linelen-1, fp)) {
+                if (!fgets(line, polyfile_linelen-1, fp.get())) {
                     std::cerr << "unable to read line from polygon file " << file << "\n";
                     return nullptr;
                 }
@@ -193,15 +428,17 @@ namespace OsmiumExtension {
                     // remember we're inside a polygon
                     ispoly = true;
 
-                    // create a new coordinate sequence
-                    c = new std::vector<geos::geom::Coordinate>();
+                    // start a new ring in the appropriate vector
+                    std::vector<ring_t>& rings = isinner ? inner : outer;
+                    rings.emplace_back();
+                    c = &rings.back();
 
                 // when we're currently inside a polygon
                 } else {
                     // if this is an end-line
                     if (0 == strncmp(line, "END", 3)) {
-                        if (!c) {
-                            std::cerr << "empty polygon file\n";
+                        if (c->empty()) {
+                            std::cerr << "empty polygon in polygon file " << file << "\n";
                             return nullptr;
                         }
 
@@ -211,34 +448,13 @@ namespace OsmiumExtension {
                             c->push_back(c->front());
                         }
 
-                        // build a polygon from the coordinate vector
-                        geos::geom::Geometry* poly;
-                        try {
-                            poly = geos_factory()->createPolygon(
-                                geos_factory()->createLinearRing(
-                                    geos_factory()->getCoordinateSequenceFactory()->create(c)
-                                ),
-                                nullptr
-                            );
-                        } catch(geos::util::GEOSException e) {
-                            std::cerr << "error creating polygon: " << e.what() << "\n";
-                            return nullptr;
-                        }
-
-                        // add it to the appropriate polygon vector
-                        if (isinner) {
-                            inner->push_back(poly);
-                        } else {
-                            outer->push_back(poly);
-                        }
-
                         // remember we're now outside a polygon
                         ispoly = false;
 
                     // an ordinary line
                     } else {
-                        // try to parse it using sscanf
-                        if (2 != sscanf(line, " %lE %lE", &x, &y)) {
+                        double x, y;
+                        if (!parse_coordinates(line, x, y)) {
                             std::cerr << "unable to parse line from polygon file " << file << ": " << line;
                             return nullptr;
                         }
@@ -255,28 +471,8 @@ namespace OsmiumExtension {
                 return nullptr;
             }
 
-            // close the file pointer
-            fclose(fp);
-
-            // build MultiPolygons from the vectors of outer and inner polygons
-            geos::geom::Geometry *poly;
-            try {
-                geos::geom::MultiPolygon *outerPoly = geos_factory()->createMultiPolygon(outer);
-                geos::geom::MultiPolygon *innerPoly = geos_factory()->createMultiPolygon(inner);
-
-                // generate a MultiPolygon containing the difference of those two
-                poly = outerPoly->difference(innerPoly);
-
-                // destroy the both MultiPolygons
-                geos_factory()->destroyGeometry(outerPoly);
-                geos_factory()->destroyGeometry(innerPoly);
-            } catch(geos::util::GEOSException e) {
-                std::cerr << "error creating differential multipolygon: " << e.what() << "\n";
-                return nullptr;
-            }
-
-            // and return their difference
-            return poly;
+            // build polygons with holes from the rings
+            return buildPolygons(outer, inner);
         } // fromPolyFile
 
         static geos::geom::Geometry *fromOsmFile(const std::string &file) {
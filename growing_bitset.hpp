@@ -1,19 +1,46 @@
 #ifndef GROWING_BITSET_HPP
 #define GROWING_BITSET_HPP
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
 #include <osmium/osm/types.hpp>
 
-class growing_bitset {
+#include "block_summary.hpp"
+#include "segment_storage.hpp"
+#include "tracker_probe.hpp"
+
+/**
+ * A bitset over object ids that grows in segments of segment_size bits
+ * as ids get set. Segments are arrays of 64 bit words, allocated zeroed
+ * from the segment_storage on first write, so untouched id ranges cost
+ * nothing. A block_summary in front of the segments turns down most ids
+ * that are not set without touching them.
+ */
+class growing_bitset : public tracker_probe<growing_bitset> {
+
+public:
+
+    typedef uint64_t word_type;
 
     static const size_t segment_size = 50*1024*1024;
+    static const size_t word_bits = 64;
+    static const size_t segment_words = segment_size / word_bits;
+
+private:
+
+    struct segment_deleter {
+        void operator()(word_type* words) const {
+            segment_storage::instance().release(words);
+        }
+    };
 
-    typedef std::vector<bool> bitvec_type;
-    typedef bitvec_type* bitvec_ptr_type;
+    typedef std::unique_ptr<word_type, segment_deleter> segment_ptr_type;
 
-    std::vector<std::unique_ptr<bitvec_type>> bitmap;
+    std::vector<segment_ptr_type> bitmap;
+
+    block_summary m_summary;
 
     static size_t segment(const osmium::object_id_type pos) {
         return pos / static_cast<osmium::object_id_type>(segment_size);
@@ -23,21 +50,25 @@ class growing_bitset {
         return pos % static_cast<osmium::object_id_type>(segment_size);
     }
 
-    bitvec_ptr_type find_segment(size_t segment) {
+    static word_type bit(size_t pos) {
+        return word_type(1) << (pos % word_bits);
+    }
+
+    word_type* find_segment(size_t segment) {
         if (segment >= bitmap.size()) {
             bitmap.resize(segment+1);
         }
 
         auto ptr = bitmap[segment].get();
         if (!ptr) {
-            bitmap[segment].reset(new bitvec_type(segment_size));
-            return bitmap[segment].get();
+            ptr = static_cast<word_type*>(segment_storage::instance().allocate(segment_words * sizeof(word_type)));
+            bitmap[segment].reset(ptr);
         }
 
         return ptr;
     }
 
-    bitvec_ptr_type find_segment(size_t segment) const {
+    const word_type* find_segment(size_t segment) const {
         if (segment >= bitmap.size()) {
             return nullptr;
         }
@@ -48,19 +79,118 @@ class growing_bitset {
 public:
 
     void set(const osmium::object_id_type pos) {
-        bitvec_ptr_type bitvec = find_segment(segment(pos));
-        bitvec->at(segmented_pos(pos)) = true;
+        m_summary.set(pos);
+        const size_t p = segmented_pos(pos);
+        find_segment(segment(pos))[p / word_bits] |= bit(p);
     }
 
     bool get(const osmium::object_id_type pos) const {
-        bitvec_ptr_type bitvec = find_segment(segment(pos));
-        if (!bitvec) return false;
-        return bitvec->at(segmented_pos(pos));
+        if (!m_summary.get(pos)) return false;
+        const word_type* words = find_segment(segment(pos));
+        if (!words) return false;
+        const size_t p = segmented_pos(pos);
+        return (words[p / word_bits] & bit(p)) != 0;
+    }
+
+    /**
+     * start loading the word of pos into the cache, get(pos) follows soon
+     */
+    void prefetch(const osmium::object_id_type pos) const {
+        if (!m_summary.get(pos)) return;
+        const word_type* words = find_segment(segment(pos));
+        if (words) {
+            __builtin_prefetch(&words[segmented_pos(pos) / word_bits]);
+        }
     }
 
+    /**
+     * release all segments, leaving an empty set
+     */
     void clear() {
-        for (auto& ptr : bitmap) {
-            ptr->clear();
+        bitmap.clear();
+        m_summary.clear();
+    }
+
+    /**
+     * the blocks of ids that may be set
+     */
+    const block_summary& summary() const {
+        return m_summary;
+    }
+
+    /**
+     * set every bit that is set in other
+     */
+    growing_bitset& operator|=(const growing_bitset& other) {
+        m_summary |= other.m_summary;
+        for (size_t s = 0; s < other.bitmap.size(); s++) {
+            const word_type* src = other.bitmap[s].get();
+            if (!src) continue;
+
+            word_type* dst = find_segment(s);
+            for (size_t w = 0; w < segment_words; w++) {
+                dst[w] |= src[w];
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * clear every bit that is not set in other
+     */
+    growing_bitset& operator&=(const growing_bitset& other) {
+        m_summary &= other.m_summary;
+        for (size_t s = 0; s < bitmap.size(); s++) {
+            word_type* dst = bitmap[s].get();
+            if (!dst) continue;
+
+            const word_type* src = other.find_segment(s);
+            if (!src) {
+                bitmap[s].reset();
+                continue;
+            }
+
+            for (size_t w = 0; w < segment_words; w++) {
+                dst[w] &= src[w];
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * number of set bits
+     */
+    size_t count() const {
+        size_t n = 0;
+        for (const auto& seg : bitmap) {
+            const word_type* words = seg.get();
+            if (!words) continue;
+
+            for (size_t w = 0; w < segment_words; w++) {
+                n += __builtin_popcountll(words[w]);
+            }
+        }
+        return n;
+    }
+
+    /**
+     * call func(id) for every set bit, in ascending order
+     */
+    template <typename TFunc>
+    void for_each(TFunc func) const {
+        for (size_t s = 0; s < bitmap.size(); s++) {
+            const word_type* words = bitmap[s].get();
+            if (!words) continue;
+
+            const osmium::object_id_type base = static_cast<osmium::object_id_type>(s * segment_size);
+            for (size_t w = 0; w < segment_words; w++) {
+                word_type word = words[w];
+                while (word) {
+                    const size_t b = __builtin_ctzll(word);
+                    func(base + static_cast<osmium::object_id_type>(w * word_bits + b));
+                    word &= word - 1;
+                }
+            }
         }
     }
 
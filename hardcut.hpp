@@ -7,7 +7,7 @@
 #include <osmium/memory/buffer.hpp>
 
 #include "cut.hpp"
-#include "growing_bitset.hpp"
+#include "id_tracker.hpp"
 
 /*
 
@@ -69,8 +69,8 @@ disadvantages:
 class HardcutExtractInfo : public ExtractInfo {
 
 public:
-    growing_bitset node_tracker;
-    growing_bitset way_tracker;
+    id_tracker node_tracker;
+    id_tracker way_tracker;
 
     HardcutExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
         ExtractInfo(name, file, header) {}
@@ -82,6 +82,11 @@ class HardcutInfo : public CutInfo<HardcutExtractInfo> {
 
 class Hardcut : public Cut<HardcutInfo> {
 
+    // which way nodes or relation members are in a tracker, kept to reuse
+    // the memory
+    std::vector<bool> m_hits;
+    std::vector<bool> m_way_hits;
+
     void copy_tags(osmium::memory::Buffer& buffer, osmium::builder::Builder& builder, const osmium::TagList& tags) {
         osmium::builder::TagListBuilder tl_builder(buffer, &builder);
         for (const auto& tag : tags) {
@@ -91,7 +96,7 @@ class Hardcut : public Cut<HardcutInfo> {
 
 public:
 
-    Hardcut(HardcutInfo *info) : Cut<HardcutInfo>(info) {
+    Hardcut(HardcutInfo *info) : Cut<HardcutInfo>(info), m_hits(), m_way_hits() {
         std::cout << "Start Hardcut:\n";
         
 
@@ -109,16 +114,14 @@ public:
             std::cerr << "hardcut node " << node.id() << " v" << node.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->contains(node)) {
-                if (debug) {
-                    std::cerr << "node " << node.id() << " v" << node.version() << " is inside bbox, writing it out\n";
-                }
+        for (const auto& extract : extracts_containing(node)) {
+            if (debug) {
+                std::cerr << "node " << node.id() << " v" << node.version() << " is inside bbox, writing it out\n";
+            }
 
-                extract->write(node);
+            extract->write(node);
 
-                extract->node_tracker.set(node.id());
-            }
+            extract->node_tracker.set(node.id());
         }
     }
 
@@ -133,12 +136,15 @@ public:
         for (const auto& extract : info->extracts) {
             node_ids.clear();
 
-            for (const auto& node_ref : way.nodes()) {
-                if (extract->node_tracker.get(node_ref.ref())) {
-                    if (debug) {
-                        std::cerr << "adding node-id " << node_ref.ref() << " to cutted way " << way.id() << " v" << way.version() << " for bbox\n";
+            if (extract->node_tracker.get_each(way.nodes(), m_hits)) {
+                size_t i = 0;
+                for (const auto& node_ref : way.nodes()) {
+                    if (m_hits[i++]) {
+                        if (debug) {
+                            std::cerr << "adding node-id " << node_ref.ref() << " to cutted way " << way.id() << " v" << way.version() << " for bbox\n";
+                        }
+                        node_ids.push_back(node_ref.ref());
                     }
-                    node_ids.push_back(node_ref.ref());
                 }
             }
 
@@ -208,10 +214,15 @@ public:
         for (const auto& extract : info->extracts) {
             members.clear();
 
-            for (const auto& member : relation.members()) {
-                if ((member.type() == osmium::item_type::node && extract->node_tracker.get(member.ref())) ||
-                   (member.type() == osmium::item_type::way  && extract->way_tracker.get(member.ref()))) {
-                    members.push_back(&member);
+            const bool nodes = extract->node_tracker.get_each(relation.members(), osmium::item_type::node, m_hits);
+            const bool ways = extract->way_tracker.get_each(relation.members(), osmium::item_type::way, m_way_hits);
+            if (nodes || ways) {
+                size_t i = 0;
+                for (const auto& member : relation.members()) {
+                    if (m_hits[i] || m_way_hits[i]) {
+                        members.push_back(&member);
+                    }
+                    i++;
                 }
             }
 
@@ -0,0 +1,21 @@
+#ifndef ID_TRACKER_HPP
+#define ID_TRACKER_HPP
+
+/*
+ * The bitset the cut algorithms record object ids in.
+ *
+ * growing_bitset is the default and the fastest when extracts are large.
+ * Building with SPLITTER_COMPRESSED_TRACKERS (cmake -DWITH_COMPRESSED_TRACKERS=ON)
+ * switches to compressed_bitset, which needs a few MB instead of hundreds
+ * of MB per extract when the extracts are small.
+ */
+
+#ifdef SPLITTER_COMPRESSED_TRACKERS
+# include "compressed_bitset.hpp"
+typedef compressed_bitset id_tracker;
+#else
+# include "growing_bitset.hpp"
+typedef growing_bitset id_tracker;
+#endif
+
+#endif // ID_TRACKER_HPP
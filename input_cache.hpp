@@ -0,0 +1,235 @@
+#ifndef SPLITTER_INPUT_CACHE_HPP
+#define SPLITTER_INPUT_CACHE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <zlib.h>
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/object.hpp>
+#include <osmium/visitor.hpp>
+
+#include "pbf_index.hpp"
+
+/**
+ * Keeps the decoded buffers of the first pass, so the later passes replay
+ * them instead of reading and decoding the input again. Inputs that can
+ * only be read once, like stdin, work with the multi-pass cuts this way.
+ *
+ * Buffers are compressed with zlib at its fastest level and kept in memory
+ * up to a budget, the ones after that go to a temp file. The id ranges of
+ * each buffer are kept along, so a pass skips the buffers without any
+ * object it wants, like with a pbf_index.
+ */
+class input_cache {
+
+    struct chunk {
+        id_ranges ids;
+
+        // size of the buffer content and of its compressed form
+        uint64_t size;
+        uint64_t compressed_size;
+
+        // compressed content, empty if it went to the spill file
+        std::string data;
+
+        // where it is in the spill file
+        uint64_t offset;
+    };
+
+    std::vector<chunk> m_chunks;
+
+    // bytes of compressed content kept in memory, and the most there may be
+    size_t m_memory;
+    size_t m_budget;
+
+    // directory for the spill file and the file itself, once needed
+    std::string m_directory;
+    int m_fd;
+    uint64_t m_spilled;
+
+    bool m_filled;
+    bool m_failed;
+
+    bool open_spill_file() {
+        std::string path = m_directory + "/osm-history-splitter-input.XXXXXX";
+        std::vector<char> tmpl(path.begin(), path.end());
+        tmpl.push_back('\0');
+
+        m_fd = mkstemp(tmpl.data());
+        if (m_fd < 0) {
+            std::cerr << "unable to create input cache file in " << m_directory << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        // the file lives as long as the descriptor, no cleanup needed on exit
+        unlink(tmpl.data());
+        return true;
+    }
+
+    bool spill(chunk& entry) {
+        if (m_fd < 0 && !open_spill_file()) {
+            return false;
+        }
+
+        const char* data = entry.data.data();
+        size_t left = entry.data.size();
+        while (left > 0) {
+            const ssize_t n = write(m_fd, data, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "unable to write input cache file in " << m_directory << ": " << strerror(errno) << "\n";
+                return false;
+            }
+            data += n;
+            left -= n;
+        }
+
+        entry.offset = m_spilled;
+        m_spilled += entry.compressed_size;
+        std::string().swap(entry.data);
+        return true;
+    }
+
+    // read the compressed content of entry back from the spill file
+    bool load(const chunk& entry, std::string& data) const {
+        data.resize(entry.compressed_size);
+        uint64_t done = 0;
+        while (done < entry.compressed_size) {
+            const ssize_t n = pread(m_fd, &data[done], entry.compressed_size - done, entry.offset + done);
+            if (n <= 0) {
+                std::cerr << "unable to read input cache file in " << m_directory << ": " << strerror(errno) << "\n";
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+public:
+
+    /**
+     * keep up to budget bytes of compressed buffers in memory, spill the
+     * rest to a temp file in directory
+     */
+    input_cache(size_t budget, const std::string& directory) :
+        m_chunks(),
+        m_memory(0),
+        m_budget(budget),
+        m_directory(directory),
+        m_fd(-1),
+        m_spilled(0),
+        m_filled(false),
+        m_failed(false) {
+    }
+
+    ~input_cache() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    input_cache(const input_cache&) = delete;
+    input_cache& operator=(const input_cache&) = delete;
+
+    /**
+     * keep a copy of buffer, in the order buffers are added
+     */
+    void add(const osmium::memory::Buffer& buffer) {
+        if (m_failed || buffer.committed() == 0) {
+            return;
+        }
+
+        m_chunks.push_back(chunk());
+        chunk& entry = m_chunks.back();
+        entry.ids.clear();
+        for (const auto& item : buffer) {
+            if (item.type() == osmium::item_type::node || item.type() == osmium::item_type::way || item.type() == osmium::item_type::relation) {
+                entry.ids.extend(id_ranges::type_index(item.type()), static_cast<const osmium::OSMObject&>(item).id());
+            }
+        }
+
+        entry.size = buffer.committed();
+        uLongf length = compressBound(entry.size);
+        entry.data.resize(length);
+        if (compress2(reinterpret_cast<Bytef*>(&entry.data[0]), &length, buffer.data(), entry.size, Z_BEST_SPEED) != Z_OK) {
+            std::cerr << "unable to compress buffer for input cache\n";
+            m_failed = true;
+            return;
+        }
+        entry.data.resize(length);
+        entry.compressed_size = length;
+
+        if (m_memory + length <= m_budget) {
+            entry.data.shrink_to_fit();
+            m_memory += length;
+        } else if (!spill(entry)) {
+            m_failed = true;
+        }
+    }
+
+    /**
+     * all of the input was added
+     */
+    void finish() {
+        m_filled = true;
+        std::cerr << "input cache holds " << m_chunks.size() << " buffers, " <<
+            m_memory / (1024 * 1024) << " MB in memory and " <<
+            m_spilled / (1024 * 1024) << " MB in " << m_directory << "\n";
+    }
+
+    bool filled() const {
+        return m_filled;
+    }
+
+    /**
+     * did keeping a buffer fail? the cache is of no use then.
+     */
+    bool failed() const {
+        return m_failed;
+    }
+
+    /**
+     * hand the buffers to handler again, leaving out the ones for which
+     * wanted(ids) returns false. returns false if a buffer can't be
+     * restored.
+     */
+    template <typename THandler, typename TWanted>
+    bool replay(THandler& handler, TWanted wanted) const {
+        std::string data;
+        for (const auto& entry : m_chunks) {
+            if (!wanted(entry.ids)) {
+                continue;
+            }
+
+            const std::string* compressed = &entry.data;
+            if (compressed->empty()) {
+                if (!load(entry, data)) {
+                    return false;
+                }
+                compressed = &data;
+            }
+
+            osmium::memory::Buffer buffer(entry.size, osmium::memory::Buffer::auto_grow::no);
+            uLongf length = entry.size;
+            if (uncompress(buffer.reserve_space(entry.size), &length, reinterpret_cast<const Bytef*>(compressed->data()), compressed->size()) != Z_OK || length != entry.size) {
+                std::cerr << "unable to restore buffer from input cache\n";
+                return false;
+            }
+            buffer.commit();
+
+            osmium::apply(buffer, handler);
+        }
+        return true;
+    }
+
+}; // class input_cache
+
+#endif // SPLITTER_INPUT_CACHE_HPP
@@ -0,0 +1,107 @@
+#ifndef SPLITTER_NODE_CLASSIFIER_HPP
+#define SPLITTER_NODE_CLASSIFIER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/visitor.hpp>
+
+#include "worker_pool.hpp"
+
+/**
+ * Works out which extracts contain each node of a buffer, spread over a
+ * worker_pool. The point-in-polygon tests are what makes the node pass
+ * CPU-bound, everything else stays on the reading thread.
+ */
+template <class TCutInfo>
+class NodeClassifier {
+
+    TCutInfo& m_info;
+    worker_pool m_pool;
+
+    // locations of the nodes in the buffer, in order
+    std::vector<osmium::Location> m_locations;
+
+    // extract numbers hit by the nodes of each worker, back to back
+    std::vector<std::vector<uint32_t>> m_hits;
+
+    // range of each nodes hits inside its workers m_hits
+    std::vector<uint32_t> m_begin;
+    std::vector<uint32_t> m_end;
+
+    size_t chunk_size() const {
+        return (m_locations.size() + m_pool.size() - 1) / m_pool.size();
+    }
+
+public:
+
+    NodeClassifier(TCutInfo& info, size_t threads) :
+        m_info(info),
+        m_pool(threads),
+        m_locations(),
+        m_hits(threads),
+        m_begin(),
+        m_end() {
+    }
+
+    /**
+     * classify all nodes in buffer, in the order they appear in it
+     */
+    void classify(osmium::memory::Buffer& buffer) {
+        m_locations.clear();
+        for (const auto& item : buffer) {
+            if (item.type() == osmium::item_type::node) {
+                m_locations.push_back(static_cast<const osmium::Node&>(item).location());
+            }
+        }
+
+        m_begin.resize(m_locations.size());
+        m_end.resize(m_locations.size());
+
+        const size_t chunk = chunk_size();
+        m_pool.run([this, chunk](size_t worker) {
+            std::vector<uint32_t>& hits = m_hits[worker];
+            hits.clear();
+
+            const size_t first = std::min(worker * chunk, m_locations.size());
+            const size_t last = std::min(first + chunk, m_locations.size());
+            m_info.classify(m_locations.data() + first, last - first, hits, m_begin.data() + first, m_end.data() + first);
+        });
+    }
+
+    /**
+     * hits of the n-th node of the last classified buffer
+     */
+    const uint32_t* begin(size_t n) const {
+        return m_hits[n / chunk_size()].data() + m_begin[n];
+    }
+
+    const uint32_t* end(size_t n) const {
+        return m_hits[n / chunk_size()].data() + m_end[n];
+    }
+
+    /**
+     * feed all objects in buffer to handler, with every node already
+     * classified
+     */
+    template <class THandler>
+    void apply(osmium::memory::Buffer& buffer, THandler& handler) {
+        classify(buffer);
+
+        size_t n = 0;
+        for (auto& item : buffer) {
+            if (item.type() == osmium::item_type::node) {
+                handler.classified(begin(n), end(n));
+                n++;
+            }
+            osmium::apply_item(item, handler);
+        }
+    }
+
+}; // class NodeClassifier
+
+#endif // SPLITTER_NODE_CLASSIFIER_HPP
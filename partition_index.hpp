@@ -0,0 +1,232 @@
+#ifndef PARTITION_INDEX_HPP
+#define PARTITION_INDEX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "fixed_point_polygon.hpp"
+
+/**
+ * Point location in a set of polygons that don't overlap, like the
+ * countries of a continent or the states of a country. One query returns
+ * the single polygon a point is inside of.
+ *
+ * A grid over all polygons records for every cell either the one polygon
+ * covering it completely, no polygon at all, or the few polygons whose
+ * borders cross it. Only points in the last kind of cell are tested
+ * exactly, and the test stops at the first polygon containing the point.
+ *
+ * If the polygons do overlap after all, a point inside several of them is
+ * only reported in one.
+ */
+class partition_index {
+
+public:
+
+    struct member {
+        uint32_t extract;
+        const fixed_point_polygon* polygon;
+    };
+
+private:
+
+    // cells along the longer side of the grid per polygon in the set,
+    // and the overall limit
+    static const int64_t cells_per_member = 64;
+    static const int64_t max_cells = 1024;
+
+    // as in polygon_raster
+    static const int64_t slack = 1;
+
+    // a cell value with this bit set is the number of a candidate list
+    static const uint32_t mixed = 0x80000000;
+
+    std::vector<member> m_members;
+
+    int64_t m_x0;
+    int64_t m_y0;
+    int64_t m_cell_size;
+    int64_t m_columns;
+    int64_t m_rows;
+
+    // 0: no polygon, 1 + m: inside member m, mixed | l: candidate list l
+    std::vector<uint32_t> m_cells;
+
+    // candidate list l is m_candidates[m_list_begin[l]] up to
+    // m_candidates[m_list_begin[l+1]]
+    std::vector<uint32_t> m_list_begin;
+    std::vector<uint32_t> m_candidates;
+
+    int64_t column(int64_t x) const {
+        return std::min(m_columns - 1, std::max<int64_t>(0, (x - m_x0) / m_cell_size));
+    }
+
+    int64_t row(int64_t y) const {
+        return std::min(m_rows - 1, std::max<int64_t>(0, (y - m_y0) / m_cell_size));
+    }
+
+    // classify the cells around member m, recording it as owner of the
+    // cells it covers and as candidate in the cells its border crosses
+    void add_member(uint32_t m, std::vector<int32_t>& owners, std::unordered_map<uint32_t, std::vector<uint32_t>>& lists) {
+        const fixed_point_polygon& polygon = *m_members[m].polygon;
+        if (polygon.edges().empty()) {
+            return;
+        }
+
+        const int64_t c0 = column(static_cast<int64_t>(polygon.min_x()) - slack);
+        const int64_t c1 = column(static_cast<int64_t>(polygon.max_x()) + slack);
+        const int64_t r0 = row(static_cast<int64_t>(polygon.min_y()) - slack);
+        const int64_t r1 = row(static_cast<int64_t>(polygon.max_y()) + slack);
+        const int64_t width = c1 - c0 + 1;
+
+        std::vector<bool> boundary(width * (r1 - r0 + 1), false);
+        for (const auto& e : polygon.edges()) {
+            fixed_point_polygon::split_edge(e, m_cell_size, [&](int64_t minx, int64_t miny, int64_t maxx, int64_t maxy) {
+                for (int64_t r = row(miny - slack); r <= row(maxy + slack); r++) {
+                    for (int64_t c = column(minx - slack); c <= column(maxx + slack); c++) {
+                        boundary[(r - r0) * width + (c - c0)] = true;
+                    }
+                }
+            });
+        }
+
+        for (int64_t r = r0; r <= r1; r++) {
+            int64_t c = c0;
+            while (c <= c1) {
+                const uint32_t cell = r * m_columns + c;
+                if (boundary[(r - r0) * width + (c - c0)]) {
+                    lists[cell].push_back(m);
+                    c++;
+                    continue;
+                }
+
+                // as in polygon_raster, one test decides a run of cells
+                const int64_t x = m_x0 + c * m_cell_size + m_cell_size / 2;
+                const int64_t y = m_y0 + r * m_cell_size + m_cell_size / 2;
+                const bool inside = polygon.contains(static_cast<int32_t>(x), static_cast<int32_t>(y));
+
+                while (c <= c1 && !boundary[(r - r0) * width + (c - c0)]) {
+                    if (inside) {
+                        int32_t& owner = owners[r * m_columns + c];
+                        if (owner < 0) {
+                            owner = m;
+                        } else {
+                            // overlapping polygons, test both exactly
+                            lists[r * m_columns + c].push_back(m);
+                        }
+                    }
+                    c++;
+                }
+            }
+        }
+    }
+
+public:
+
+    explicit partition_index(const std::vector<member>& members) :
+        m_members(members),
+        m_x0(0),
+        m_y0(0),
+        m_cell_size(1),
+        m_columns(0),
+        m_rows(0),
+        m_cells(),
+        m_list_begin(),
+        m_candidates() {
+        int64_t min_x = std::numeric_limits<int32_t>::max();
+        int64_t min_y = std::numeric_limits<int32_t>::max();
+        int64_t max_x = std::numeric_limits<int32_t>::min();
+        int64_t max_y = std::numeric_limits<int32_t>::min();
+        for (const auto& m : m_members) {
+            if (m.polygon->edges().empty()) continue;
+            min_x = std::min<int64_t>(min_x, m.polygon->min_x());
+            min_y = std::min<int64_t>(min_y, m.polygon->min_y());
+            max_x = std::max<int64_t>(max_x, m.polygon->max_x());
+            max_y = std::max<int64_t>(max_y, m.polygon->max_y());
+        }
+        if (min_x > max_x) {
+            return;
+        }
+
+        m_x0 = min_x - slack;
+        m_y0 = min_y - slack;
+        const int64_t width = max_x + slack - m_x0 + 1;
+        const int64_t height = max_y + slack - m_y0 + 1;
+
+        // no std::min here, it would bind a reference to max_cells
+        const int64_t wanted = cells_per_member * static_cast<int64_t>(std::ceil(std::sqrt(m_members.size())));
+        const int64_t cells = wanted < max_cells ? wanted : max_cells;
+        m_cell_size = std::max<int64_t>(1, (std::max(width, height) + cells - 1) / cells);
+        m_columns = (width + m_cell_size - 1) / m_cell_size;
+        m_rows = (height + m_cell_size - 1) / m_cell_size;
+
+        std::vector<int32_t> owners(m_columns * m_rows, -1);
+        std::unordered_map<uint32_t, std::vector<uint32_t>> lists;
+        for (uint32_t m = 0; m < m_members.size(); m++) {
+            add_member(m, owners, lists);
+        }
+
+        m_cells.resize(owners.size());
+        for (size_t cell = 0; cell < owners.size(); cell++) {
+            m_cells[cell] = owners[cell] < 0 ? 0 : owners[cell] + 1;
+        }
+
+        // cells crossed by borders also get tested against a polygon that
+        // covers them completely, that only happens if polygons overlap
+        m_list_begin.push_back(0);
+        for (auto& list : lists) {
+            if (owners[list.first] >= 0) {
+                list.second.push_back(owners[list.first]);
+            }
+            m_cells[list.first] = mixed | static_cast<uint32_t>(m_list_begin.size() - 1);
+            m_candidates.insert(m_candidates.end(), list.second.begin(), list.second.end());
+            m_list_begin.push_back(m_candidates.size());
+        }
+    }
+
+    /**
+     * find the polygon the point given in osmium fixed point coordinates
+     * is inside of. returns false if it isn't inside any, otherwise sets
+     * extract to the extract number of that polygon.
+     */
+    bool find(int32_t x, int32_t y, uint32_t& extract) const {
+        const int64_t dx = x - m_x0;
+        const int64_t dy = y - m_y0;
+        if (dx < 0 || dy < 0) {
+            return false;
+        }
+
+        const int64_t c = dx / m_cell_size;
+        const int64_t r = dy / m_cell_size;
+        if (c >= m_columns || r >= m_rows) {
+            return false;
+        }
+
+        const uint32_t cell = m_cells[r * m_columns + c];
+        if (cell == 0) {
+            return false;
+        }
+
+        if (!(cell & mixed)) {
+            extract = m_members[cell - 1].extract;
+            return true;
+        }
+
+        const uint32_t list = cell & ~mixed;
+        for (uint32_t i = m_list_begin[list]; i < m_list_begin[list+1]; i++) {
+            const member& m = m_members[m_candidates[i]];
+            if (m.polygon->contains(x, y)) {
+                extract = m.extract;
+                return true;
+            }
+        }
+        return false;
+    }
+
+}; // class partition_index
+
+#endif // PARTITION_INDEX_HPP
@@ -0,0 +1,512 @@
+#ifndef SPLITTER_PBF_INDEX_HPP
+#define SPLITTER_PBF_INDEX_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/types.hpp>
+
+/**
+ * A protobuf message, read field by field. Only what the blob structure
+ * and the ids of a PBF file need is there.
+ */
+class pbf_message {
+
+    const unsigned char* m_data;
+    const unsigned char* m_end;
+
+public:
+
+    enum wire_type {
+        VARINT = 0,
+        FIXED64 = 1,
+        LENGTH = 2,
+        FIXED32 = 5
+    };
+
+    pbf_message(const char* data, size_t size) :
+        m_data(reinterpret_cast<const unsigned char*>(data)),
+        m_end(reinterpret_cast<const unsigned char*>(data) + size) {
+    }
+
+    bool empty() const {
+        return m_data == m_end;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64 && m_data != m_end; shift += 7) {
+            const unsigned char byte = *m_data++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool svarint(int64_t& value) {
+        uint64_t raw;
+        if (!varint(raw)) {
+            return false;
+        }
+        value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+        return true;
+    }
+
+    /**
+     * read the key of the next field. false at the end of the message.
+     */
+    bool next(uint32_t& field, uint32_t& wire) {
+        uint64_t key;
+        if (empty() || !varint(key)) {
+            return false;
+        }
+        field = static_cast<uint32_t>(key >> 3);
+        wire = static_cast<uint32_t>(key & 7);
+        return true;
+    }
+
+    bool bytes(const char*& data, size_t& size) {
+        uint64_t length;
+        if (!varint(length) || length > static_cast<uint64_t>(m_end - m_data)) {
+            return false;
+        }
+        data = reinterpret_cast<const char*>(m_data);
+        size = length;
+        m_data += length;
+        return true;
+    }
+
+    bool skip(uint32_t wire) {
+        uint64_t value;
+        const char* data;
+        size_t size;
+        switch (wire) {
+            case VARINT:
+                return varint(value);
+            case FIXED64:
+                if (m_end - m_data < 8) return false;
+                m_data += 8;
+                return true;
+            case LENGTH:
+                return bytes(data, size);
+            case FIXED32:
+                if (m_end - m_data < 4) return false;
+                m_data += 4;
+                return true;
+        }
+        return false;
+    }
+
+}; // class pbf_message
+
+/**
+ * The smallest and largest id of the nodes, ways and relations in a part
+ * of the input, indexed by type_index(). first > last if there are none.
+ */
+struct id_ranges {
+
+    osmium::object_id_type first[3];
+    osmium::object_id_type last[3];
+
+    static size_t type_index(osmium::item_type type) {
+        switch (type) {
+            case osmium::item_type::node:
+                return 0;
+            case osmium::item_type::way:
+                return 1;
+            default:
+                return 2;
+        }
+    }
+
+    // no ids at all
+    void clear() {
+        for (size_t type = 0; type < 3; type++) {
+            first[type] = std::numeric_limits<osmium::object_id_type>::max();
+            last[type] = std::numeric_limits<osmium::object_id_type>::min();
+        }
+    }
+
+    // every id there may be
+    void fill() {
+        for (size_t type = 0; type < 3; type++) {
+            first[type] = std::numeric_limits<osmium::object_id_type>::min();
+            last[type] = std::numeric_limits<osmium::object_id_type>::max();
+        }
+    }
+
+    void extend(size_t type, osmium::object_id_type id) {
+        if (id < first[type]) first[type] = id;
+        if (id > last[type]) last[type] = id;
+    }
+
+    bool has(size_t type) const {
+        return first[type] <= last[type];
+    }
+
+}; // struct id_ranges
+
+/**
+ * Where the blobs of a PBF file are and which ids they hold, so later
+ * passes can leave out blobs without any object they look at, and what
+ * the file header requires of a reader, for copying blobs to an output
+ * unchanged.
+ *
+ * The index is built by reading the file on its own, meant to run on a
+ * thread of its own while the first pass reads the file through osmium.
+ * Blobs it can't decompress (lz4, zstd, ...) are taken to hold every id.
+ */
+class pbf_index {
+
+public:
+
+    struct blob : public id_ranges {
+        // of the length in front of the blob header, and the size of
+        // length, header and blob together
+        uint64_t offset;
+        uint64_t size;
+
+        // an OSMData blob, otherwise the OSMHeader
+        bool data;
+
+        // number of nodes, ways and relations in an OSMData blob, 0 if
+        // it couldn't be read
+        uint64_t objects;
+    };
+
+    // limits from the PBF format
+    static const uint32_t max_header_size = 64 * 1024;
+    static const uint32_t max_blob_size = 32 * 1024 * 1024;
+
+    /**
+     * read the type and the size of the blob following a BlobHeader
+     * message. false if it is damaged.
+     */
+    static bool blob_header(const char* data, size_t size, std::string& type, uint64_t& data_size) {
+        pbf_message message(data, size);
+        uint32_t field, wire;
+        const char* type_data = nullptr;
+        size_t type_size = 0;
+        data_size = 0;
+        while (message.next(field, wire)) {
+            if (field == 1 && wire == pbf_message::LENGTH) {
+                if (!message.bytes(type_data, type_size)) return false;
+            } else if (field == 3 && wire == pbf_message::VARINT) {
+                if (!message.varint(data_size)) return false;
+            } else if (!message.skip(wire)) {
+                return false;
+            }
+        }
+        if (!type_data || data_size > max_blob_size) {
+            return false;
+        }
+        type.assign(type_data, type_size);
+        return true;
+    }
+
+private:
+
+    std::vector<blob> m_blobs;
+    bool m_valid;
+
+    // the required_features of the file header, if it could be read
+    std::vector<std::string> m_required_features;
+    bool m_features_read;
+
+    // the uncompressed content of the blob being read, kept to reuse it
+    std::string m_block;
+
+    // id of a Node, Way or Relation message, always field 1
+    static bool object_id(const char* data, size_t size, bool zigzag, osmium::object_id_type& id) {
+        pbf_message message(data, size);
+        uint32_t field, wire;
+        while (message.next(field, wire)) {
+            if (field == 1 && wire == pbf_message::VARINT) {
+                if (zigzag) {
+                    int64_t value;
+                    if (!message.svarint(value)) return false;
+                    id = value;
+                } else {
+                    uint64_t value;
+                    if (!message.varint(value)) return false;
+                    id = static_cast<osmium::object_id_type>(value);
+                }
+                return true;
+            }
+            if (!message.skip(wire)) return false;
+        }
+        return false;
+    }
+
+    // the delta coded ids of a DenseNodes message
+    static bool dense_ids(const char* data, size_t size, blob& entry) {
+        pbf_message message(data, size);
+        uint32_t field, wire;
+        while (message.next(field, wire)) {
+            if (field == 1 && wire == pbf_message::LENGTH) {
+                const char* packed;
+                size_t packed_size;
+                if (!message.bytes(packed, packed_size)) return false;
+
+                pbf_message ids(packed, packed_size);
+                osmium::object_id_type id = 0;
+                while (!ids.empty()) {
+                    int64_t delta;
+                    if (!ids.svarint(delta)) return false;
+                    id += delta;
+                    entry.extend(0, id);
+                    entry.objects++;
+                }
+            } else if (!message.skip(wire)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool group_ids(const char* data, size_t size, blob& entry) {
+        pbf_message message(data, size);
+        uint32_t field, wire;
+        while (message.next(field, wire)) {
+            if (wire != pbf_message::LENGTH || field < 1 || field > 4) {
+                if (!message.skip(wire)) return false;
+                continue;
+            }
+
+            const char* object;
+            size_t object_size;
+            if (!message.bytes(object, object_size)) return false;
+
+            osmium::object_id_type id;
+            switch (field) {
+                case 1: // Node
+                    if (!object_id(object, object_size, true, id)) return false;
+                    entry.extend(0, id);
+                    entry.objects++;
+                    break;
+                case 2: // DenseNodes
+                    if (!dense_ids(object, object_size, entry)) return false;
+                    break;
+                case 3: // Way
+                    if (!object_id(object, object_size, false, id)) return false;
+                    entry.extend(1, id);
+                    entry.objects++;
+                    break;
+                case 4: // Relation
+                    if (!object_id(object, object_size, false, id)) return false;
+                    entry.extend(2, id);
+                    entry.objects++;
+                    break;
+            }
+        }
+        return true;
+    }
+
+    // the content of a Blob message, inflated into m_block if it is zlib
+    // compressed. raw is nullptr for a compression we can't read.
+    bool blob_content(const char* data, size_t size, const char*& raw, size_t& raw_size) {
+        pbf_message message(data, size);
+        uint32_t field, wire;
+        raw = nullptr;
+        raw_size = 0;
+        const char* zlib_data = nullptr;
+        size_t zlib_size = 0;
+        uint64_t uncompressed_size = 0;
+
+        while (message.next(field, wire)) {
+            if (field == 1 && wire == pbf_message::LENGTH) {
+                if (!message.bytes(raw, raw_size)) return false;
+            } else if (field == 2 && wire == pbf_message::VARINT) {
+                if (!message.varint(uncompressed_size)) return false;
+            } else if (field == 3 && wire == pbf_message::LENGTH) {
+                if (!message.bytes(zlib_data, zlib_size)) return false;
+            } else if (!message.skip(wire)) {
+                return false;
+            }
+        }
+
+        if (zlib_data) {
+            if (uncompressed_size > max_blob_size) return false;
+            m_block.resize(uncompressed_size);
+            uLongf length = uncompressed_size;
+            if (uncompress(reinterpret_cast<Bytef*>(&m_block[0]), &length, reinterpret_cast<const Bytef*>(zlib_data), zlib_size) != Z_OK || length != uncompressed_size) {
+                return false;
+            }
+            raw = m_block.data();
+            raw_size = length;
+        }
+        return true;
+    }
+
+    // fill in the id ranges of entry from a Blob message holding a
+    // PrimitiveBlock
+    bool block_ids(const char* data, size_t size, blob& entry) {
+        const char* raw;
+        size_t raw_size;
+        if (!blob_content(data, size, raw, raw_size)) {
+            return false;
+        }
+        if (!raw) {
+            // a compression we can't read, the blob may hold anything
+            entry.fill();
+            return true;
+        }
+
+        uint32_t field, wire;
+        pbf_message block(raw, raw_size);
+        while (block.next(field, wire)) {
+            if (field == 2 && wire == pbf_message::LENGTH) {
+                const char* group;
+                size_t group_size;
+                if (!block.bytes(group, group_size) || !group_ids(group, group_size, entry)) return false;
+            } else if (!block.skip(wire)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // read the required_features of a Blob message holding a HeaderBlock
+    bool header_features(const char* data, size_t size) {
+        const char* raw;
+        size_t raw_size;
+        if (!blob_content(data, size, raw, raw_size)) {
+            return false;
+        }
+        if (!raw) {
+            return true;
+        }
+
+        pbf_message block(raw, raw_size);
+        uint32_t field, wire;
+        while (block.next(field, wire)) {
+            if (field == 4 && wire == pbf_message::LENGTH) {
+                const char* feature;
+                size_t feature_size;
+                if (!block.bytes(feature, feature_size)) return false;
+                m_required_features.push_back(std::string(feature, feature_size));
+            } else if (!block.skip(wire)) {
+                return false;
+            }
+        }
+        m_features_read = true;
+        return true;
+    }
+
+public:
+
+    pbf_index() :
+        m_blobs(),
+        m_valid(false),
+        m_required_features(),
+        m_features_read(false),
+        m_block() {
+    }
+
+    /**
+     * read all of the PBF file filename and record its blobs. returns
+     * false and leaves the index invalid if the file is no PBF file or
+     * is damaged, later passes then read all of it.
+     */
+    bool build(const std::string& filename) {
+        m_blobs.clear();
+        m_valid = false;
+        m_required_features.clear();
+        m_features_read = false;
+
+        std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(filename.c_str(), "rb"), fclose);
+        if (!file) {
+            std::cerr << "can't open " << filename << " to index it: " << strerror(errno) << "\n";
+            return false;
+        }
+
+        std::string header;
+        std::string data;
+        uint64_t offset = 0;
+        unsigned char length_bytes[4];
+
+        while (fread(length_bytes, 1, 4, file.get()) == 4) {
+            const uint32_t header_size =
+                (uint32_t(length_bytes[0]) << 24) | (uint32_t(length_bytes[1]) << 16) |
+                (uint32_t(length_bytes[2]) << 8) | uint32_t(length_bytes[3]);
+            if (header_size > max_header_size) {
+                return false;
+            }
+
+            header.resize(header_size);
+            if (fread(&header[0], 1, header_size, file.get()) != header_size) {
+                return false;
+            }
+
+            std::string type;
+            uint64_t data_size;
+            if (!blob_header(header.data(), header.size(), type, data_size)) {
+                return false;
+            }
+
+            data.resize(data_size);
+            if (fread(&data[0], 1, data_size, file.get()) != data_size) {
+                return false;
+            }
+
+            blob entry;
+            entry.offset = offset;
+            entry.size = 4 + header_size + data_size;
+            entry.objects = 0;
+            entry.clear();
+
+            if (type == "OSMHeader") {
+                entry.data = false;
+                if (!header_features(data.data(), data.size())) {
+                    return false;
+                }
+            } else if (type == "OSMData") {
+                entry.data = true;
+                if (!block_ids(data.data(), data.size(), entry)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+
+            m_blobs.push_back(entry);
+            offset += entry.size;
+        }
+
+        m_valid = !ferror(file.get()) && feof(file.get()) && !m_blobs.empty() && !m_blobs.front().data;
+        std::string().swap(m_block);
+        return m_valid;
+    }
+
+    bool valid() const {
+        return m_valid;
+    }
+
+    const std::vector<blob>& blobs() const {
+        return m_blobs;
+    }
+
+    /**
+     * the features the file header requires of a reader. false if the
+     * header couldn't be read.
+     */
+    bool required_features(std::vector<std::string>& features) const {
+        features = m_required_features;
+        return m_features_read;
+    }
+
+}; // class pbf_index
+
+#endif // SPLITTER_PBF_INDEX_HPP
@@ -0,0 +1,162 @@
+#ifndef POLYGON_RASTER_HPP
+#define POLYGON_RASTER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "fixed_point_polygon.hpp"
+
+/**
+ * A coarse grid over the envelope of an extract polygon that answers most
+ * point-in-polygon questions with a single array lookup.
+ *
+ * Every cell crossed by an edge of the polygon is marked as boundary,
+ * all other cells lie completely inside or completely outside. Only points
+ * in boundary cells need the exact test.
+ *
+ * The grid is built from a fixed_point_polygon and works on osmiums fixed
+ * point coordinates, so a node location is looked up without converting it
+ * to double.
+ */
+class polygon_raster {
+
+public:
+
+    enum cell_type : uint8_t {
+        outside = 0,
+        inside = 1,
+        boundary = 2
+    };
+
+    // number of cells along the longer side of the envelope
+    static const int64_t max_cells = 512;
+
+private:
+
+    // cells are widened by this many fixed point units on every side to
+    // make up for rounding where edges are cut into pieces
+    static const int64_t slack = 1;
+
+    // fixed point coordinates of the lower left corner of the grid
+    int64_t m_x0;
+    int64_t m_y0;
+
+    // width and height of the square cells in fixed point units
+    int64_t m_cell_size;
+
+    int64_t m_columns;
+    int64_t m_rows;
+
+    std::vector<uint8_t> m_cells;
+
+    // geometry_cache fills in a default constructed raster
+    friend class geometry_cache;
+
+    polygon_raster() :
+        m_x0(0),
+        m_y0(0),
+        m_cell_size(1),
+        m_columns(0),
+        m_rows(0),
+        m_cells() {
+    }
+
+    uint8_t& cell(int64_t column, int64_t row) {
+        return m_cells[row * m_columns + column];
+    }
+
+    void mark_boundary(int64_t minx, int64_t miny, int64_t maxx, int64_t maxy) {
+        const int64_t c0 = std::max<int64_t>(0, (minx - slack - m_x0) / m_cell_size);
+        const int64_t c1 = std::min<int64_t>(m_columns - 1, (maxx + slack - m_x0) / m_cell_size);
+        const int64_t r0 = std::max<int64_t>(0, (miny - slack - m_y0) / m_cell_size);
+        const int64_t r1 = std::min<int64_t>(m_rows - 1, (maxy + slack - m_y0) / m_cell_size);
+
+        for (int64_t row = r0; row <= r1; row++) {
+            for (int64_t column = c0; column <= c1; column++) {
+                cell(column, row) = boundary;
+            }
+        }
+    }
+
+    // a run of cells in a row without boundary cells in between is not
+    // crossed by any edge, so all of it is on the same side. one exact test
+    // at the center of the first cell decides for the whole run.
+    void fill_row(int64_t row, const fixed_point_polygon& polygon) {
+        int64_t column = 0;
+        while (column < m_columns) {
+            if (cell(column, row) == boundary) {
+                column++;
+                continue;
+            }
+
+            const int64_t x = m_x0 + column * m_cell_size + m_cell_size / 2;
+            const int64_t y = m_y0 + row * m_cell_size + m_cell_size / 2;
+            const uint8_t type = polygon.contains(static_cast<int32_t>(x), static_cast<int32_t>(y)) ? inside : outside;
+
+            while (column < m_columns && cell(column, row) != boundary) {
+                cell(column, row) = type;
+                column++;
+            }
+        }
+    }
+
+public:
+
+    explicit polygon_raster(const fixed_point_polygon& polygon) :
+        m_x0(0),
+        m_y0(0),
+        m_cell_size(1),
+        m_columns(0),
+        m_rows(0),
+        m_cells() {
+        if (polygon.edges().empty()) {
+            return;
+        }
+
+        m_x0 = static_cast<int64_t>(polygon.min_x()) - slack;
+        m_y0 = static_cast<int64_t>(polygon.min_y()) - slack;
+        const int64_t width = static_cast<int64_t>(polygon.max_x()) + slack - m_x0 + 1;
+        const int64_t height = static_cast<int64_t>(polygon.max_y()) + slack - m_y0 + 1;
+
+        m_cell_size = std::max<int64_t>(1, (std::max(width, height) + max_cells - 1) / max_cells);
+        m_columns = (width + m_cell_size - 1) / m_cell_size;
+        m_rows = (height + m_cell_size - 1) / m_cell_size;
+        m_cells.assign(m_columns * m_rows, outside);
+
+        // mark all cells the edges pass through
+        for (const auto& e : polygon.edges()) {
+            fixed_point_polygon::split_edge(e, m_cell_size, [this](int64_t minx, int64_t miny, int64_t maxx, int64_t maxy) {
+                mark_boundary(minx, miny, maxx, maxy);
+            });
+        }
+
+        for (int64_t row = 0; row < m_rows; row++) {
+            fill_row(row, polygon);
+        }
+    }
+
+    /**
+     * classify a point given in osmium fixed point coordinates. anything
+     * outside the grid, including undefined locations, is outside.
+     */
+    cell_type classify(int32_t x, int32_t y) const {
+        const int64_t dx = x - m_x0;
+        const int64_t dy = y - m_y0;
+        if (dx < 0 || dy < 0) {
+            return outside;
+        }
+
+        const int64_t column = dx / m_cell_size;
+        const int64_t row = dy / m_cell_size;
+        if (column >= m_columns || row >= m_rows) {
+            return outside;
+        }
+
+        return static_cast<cell_type>(m_cells[row * m_columns + column]);
+    }
+
+}; // class polygon_raster
+
+#endif // POLYGON_RASTER_HPP
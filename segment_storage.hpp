@@ -0,0 +1,235 @@
+#ifndef SEGMENT_STORAGE_HPP
+#define SEGMENT_STORAGE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Hands out the fixed size, zeroed memory blocks growing_bitset uses as
+ * segments.
+ *
+ * By default blocks come from the heap. When a scratch directory is set,
+ * blocks are instead mapped from a single sparse file in that directory.
+ * The file only ever grows with ftruncate, so untouched ranges stay holes
+ * and cost neither disk nor RAM, and the kernel can page tracker memory
+ * out to the file instead of the process running out of memory.
+ *
+ * With huge pages enabled, heap blocks are mapped on their own and marked
+ * for transparent huge pages. Lookups spread over a block then miss the
+ * TLB far less often. The scratch file can't use them.
+ */
+class segment_storage {
+
+    std::string m_directory;
+    int m_fd;
+
+    // size of the blocks handed out, all blocks have the same size
+    size_t m_block_size;
+
+    // number of blocks the scratch file has room for
+    size_t m_blocks;
+
+    // blocks released and punched back into holes, ready for reuse
+    std::vector<size_t> m_free_blocks;
+
+    // mapped address -> block number in the scratch file
+    std::unordered_map<void*, size_t> m_mapped;
+
+    bool m_huge_pages;
+
+    // mapped address -> size of blocks mapped for huge pages
+    std::unordered_map<void*, size_t> m_huge_mapped;
+
+    segment_storage() :
+        m_directory(),
+        m_fd(-1),
+        m_block_size(0),
+        m_blocks(0),
+        m_free_blocks(),
+        m_mapped(),
+        m_huge_pages(false),
+        m_huge_mapped() {
+    }
+
+    ~segment_storage() {
+        for (const auto& m : m_mapped) {
+            munmap(m.first, m_block_size);
+        }
+        for (const auto& m : m_huge_mapped) {
+            munmap(m.first, m.second);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    void* map_block(size_t size) {
+        if (m_block_size == 0) {
+            m_block_size = size;
+        } else if (m_block_size != size) {
+            std::cerr << "scratch file blocks must all have the same size\n";
+            throw std::bad_alloc();
+        }
+
+        size_t block;
+        if (!m_free_blocks.empty()) {
+            block = m_free_blocks.back();
+            m_free_blocks.pop_back();
+        } else {
+            block = m_blocks;
+            if (ftruncate(m_fd, static_cast<off_t>((block + 1) * m_block_size)) != 0) {
+                std::cerr << "unable to grow scratch file in " << m_directory << ": " << strerror(errno) << "\n";
+                throw std::bad_alloc();
+            }
+            m_blocks++;
+        }
+
+        void* ptr = mmap(nullptr, m_block_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, m_fd, static_cast<off_t>(block * m_block_size));
+        if (ptr == MAP_FAILED) {
+            std::cerr << "unable to map scratch file in " << m_directory << ": " << strerror(errno) << "\n";
+            m_free_blocks.push_back(block);
+            throw std::bad_alloc();
+        }
+
+        m_mapped[ptr] = block;
+        return ptr;
+    }
+
+    void* map_huge(size_t size) {
+        // map one huge page more than needed and cut off the ends, so the
+        // block starts on a huge page boundary
+        const size_t huge_page = 2 * 1024 * 1024;
+        const size_t mapped = size + huge_page;
+
+        void* ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        char* begin = static_cast<char*>(ptr);
+        char* aligned = begin + (huge_page - reinterpret_cast<uintptr_t>(begin) % huge_page) % huge_page;
+        if (aligned > begin) {
+            munmap(begin, aligned - begin);
+        }
+        if (begin + mapped > aligned + size) {
+            munmap(aligned + size, begin + mapped - (aligned + size));
+        }
+
+        // only a hint, without transparent huge pages the block still works
+        madvise(aligned, size, MADV_HUGEPAGE);
+
+        m_huge_mapped[aligned] = size;
+        return aligned;
+    }
+
+public:
+
+    static segment_storage& instance() {
+        static segment_storage storage;
+        return storage;
+    }
+
+    /**
+     * place all blocks allocated from now on in a sparse file inside
+     * directory. returns false if the file can't be created.
+     */
+    bool set_directory(const std::string& directory) {
+        std::string path = directory + "/osm-history-splitter.XXXXXX";
+        std::vector<char> tmpl(path.begin(), path.end());
+        tmpl.push_back('\0');
+
+        int fd = mkstemp(tmpl.data());
+        if (fd < 0) {
+            std::cerr << "unable to create scratch file in " << directory << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        // the file lives as long as the descriptor, no cleanup needed on exit
+        unlink(tmpl.data());
+
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+        m_fd = fd;
+        m_directory = directory;
+        m_blocks = 0;
+        m_free_blocks.clear();
+        return true;
+    }
+
+    // the scratch directory, empty if there is none
+    const std::string& directory() const {
+        return m_directory;
+    }
+
+    bool is_mapped() const {
+        return m_fd >= 0;
+    }
+
+    /**
+     * back blocks allocated from the heap from now on with transparent
+     * huge pages
+     */
+    void set_huge_pages(bool huge_pages) {
+        m_huge_pages = huge_pages;
+    }
+
+    /**
+     * allocate a zeroed block of size bytes
+     */
+    void* allocate(size_t size) {
+        if (m_fd >= 0) {
+            return map_block(size);
+        }
+
+        if (m_huge_pages) {
+            return map_huge(size);
+        }
+
+        // calloc hands out lazily zeroed pages for allocations this big
+        void* ptr = std::calloc(size, 1);
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void release(void* ptr) {
+        auto huge = m_huge_mapped.find(ptr);
+        if (huge != m_huge_mapped.end()) {
+            munmap(ptr, huge->second);
+            m_huge_mapped.erase(huge);
+            return;
+        }
+
+        auto it = m_mapped.find(ptr);
+        if (it == m_mapped.end()) {
+            std::free(ptr);
+            return;
+        }
+
+        const size_t block = it->second;
+        m_mapped.erase(it);
+        munmap(ptr, m_block_size);
+
+        // turn the block back into a hole so it reads as zero when reused,
+        // if the filesystem can't do that just don't reuse it
+        if (fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(block * m_block_size), static_cast<off_t>(m_block_size)) == 0) {
+            m_free_blocks.push_back(block);
+        }
+    }
+
+}; // class segment_storage
+
+#endif // SEGMENT_STORAGE_HPP
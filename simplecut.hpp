@@ -2,67 +2,52 @@
 #define SPLITTER_SIMPLECUT_HPP
 
 #include "cut.hpp"
-#include "growing_bitset.hpp"
+#include "extract_membership.hpp"
 
 /*
 
 Simplecut Algorithm
+
+Instead of one node-, way- and relation-tracker per bbox, simplecut keeps one
+membership index per object type that stores for every id the set of bboxes
+it belongs to (see extract_membership.hpp).
+
  - walk over all node-versions
    - walk over all bboxes
      - if the current node-version is inside the bbox
-       - record its id in the bboxes node-tracker
+       - add the bbox to the node-ids set in the node-index
 
- - initialize the current-way-id to 0
  - walk over all way-versions
-   - if current-way-id != 0 and current-way-id != the id of the currently iterated way (in other words: this is a different way)
-     - walk over all bboxes
-       - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-         - append all nodes of the current-way-nodes set to the extra-node-tracker
-     - clear the current-way-nodes set
-   - update the current-way-id
-   - walk over all way-nodes
-     - append the node-ids to the current-way-nodes set
-   - walk over all bboxes
-     - walk over all way-nodes
-       - if the way-node is recorded in the bboxes node-tracker
-         - record its id in the bboxes way-id-tracker
-
-- after all ways
-  - walk over all bboxes
-    - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-      - append all nodes of the current-way-nodes set to the extra-node-tracker
+   - unite the sets of all way-nodes in the node-index
+   - add them to the way-ids set in the way-index
 
  - walk over all relation-versions
-   - walk over all bboxes
-     - walk over all relation-members
-       - if the relation-member is recorded in the bboxes node- or way-tracker
-         - record its id in the bboxes relation-tracker
+   - unite the sets of all node- and way-members in the node- and way-index
+   - add them to the relation-ids set in the relation-index
 
 Second Pass
  - walk over all node-versions
-   - walk over all bboxes
-     - if the node-id is recorded in the bboxes node-tracker or in the extra-node-tracker
-       - send the node to the bboxes writer
+   - walk over all bboxes in the node-ids set in the node-index
+     - send the node to the bboxes writer
 
  - walk over all way-versions
-   - walk over all bboxes
-     - if the way-id is recorded in the bboxes way-tracker
-       - send the way to the bboxes writer
+   - walk over all bboxes in the way-ids set in the way-index
+     - send the way to the bboxes writer
 
  - walk over all relation-versions
-   - walk over all bboxes
-     - if the relation-id is recorded in the bboxes relation-tracker
-       - send the relation to the bboxes writer
+   - walk over all bboxes in the relation-ids set in the relation-index
+     - send the relation to the bboxes writer
 
 features:
  - if an object is in the extract, all versions of it are there
  - ways and relations are not changed
- - ways are reference-complete
+ - each object is looked up once, not once per bbox, so hundreds of bboxes can be cut in one run
 
 disadvantages
  - dual pass
- - needs more RAM: 350 MB per BBOX
-   - ((1400000000÷8)+(1400000000÷8)+(130000000÷8)+(1500000÷8))÷1024÷1024 MB
+ - ways are not reference-complete
+ - needs RAM independent of the number of bboxes: 1 byte per id, 2 bytes per id when there are more than 256 distinct combinations of bboxes
+   - (1400000000+130000000+1500000)÷1024÷1024 MB
  - relations will have dead references
 
 */
@@ -71,26 +56,30 @@ disadvantages
 class SimplecutExtractInfo : public ExtractInfo {
 
 public:
-    growing_bitset node_tracker;
-    growing_bitset way_tracker;
-    growing_bitset relation_tracker;
-
     SimplecutExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
         ExtractInfo(name, file, header) {}
 };
 
 class SimplecutInfo : public CutInfo<SimplecutExtractInfo> {
 
+public:
+    extract_masks masks;
+    extract_membership node_index;
+    extract_membership way_index;
+    extract_membership relation_index;
+
+    SimplecutInfo() :
+        masks(),
+        node_index(masks),
+        way_index(masks),
+        relation_index(masks) {
+    }
+
 };
 
 
 class SimplecutPassOne : public Cut<SimplecutInfo> {
 
-    // - walk over all bboxes
-    //   - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //     - append all nodes of the current-way-nodes set to the extra-node-tracker
-   
-
 public:
 
     SimplecutPassOne(SimplecutInfo *info) : Cut<SimplecutInfo>(info){
@@ -99,92 +88,70 @@ public:
             std::cout << "\textract " << extract->name << "\n";
         }
 
+        info->masks.set_extract_count(info->extracts.size());
+
         std::cout << "\n\n=====simplecut first-pass=====\n\n";
-        
     }
 
     // - walk over all node-versions
     //   - walk over all bboxes
     //     - if the current node-version is inside the bbox
-    //       - record its id in the bboxes node-tracker
+    //       - add the bbox to the node-ids set in the node-index
     void node(const osmium::Node& node) {
         if (debug) {
             std::cerr << "simplecut node " << node.id() << " v" << node.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->contains(node)) {
-                if (debug) std::cerr << "node is in extract, recording in node_tracker\n";
+        extract_masks::code_type code = extract_masks::none;
+        for (const auto& extract : extracts_containing(node)) {
+            if (debug) std::cerr << "node is in extract, recording in node_index\n";
 
-                extract->node_tracker.set(node.id());
-            }
+            code = info->masks.merge(code, info->masks.single(extract->index));
         }
+
+        info->node_index.add(node.id(), code);
     }
 
-    // - initialize the current-way-id to 0
     // - walk over all way-versions
-    //   - if current-way-id != 0 and current-way-id != the id of the currently iterated way (in other words: this is a different way)
-    //     - walk over all bboxes
-    //       - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //         - append all nodes of the current-way-nodes set to the extra-node-tracker
-    //     - clear the current-way-nodes set
-    //   - update the current-way-id
-    //   - walk over all way-nodes
-    //     - append the node-ids to the current-way-nodes set
-    //   - walk over all bboxes
-    //     - walk over all way-nodes
-    //       - if the way-node is recorded in the bboxes node-tracker
-    //         - record its id in the bboxes way-id-tracker
-    //
-    // - after all ways
-    //   - walk over all bboxes
-    //     - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //       - append all nodes of the current-way-nodes set to the extra-node-tracker
-
+    //   - unite the sets of all way-nodes in the node-index
+    //   - add them to the way-ids set in the way-index
     void way(const osmium::Way& way) {
         if (debug) {
             std::cerr << "simplecut way " << way.id() << " v" << way.version() << "\n";
         }
-        for (const auto& extract : info->extracts) {
-            for (const auto& node_ref : way.nodes()) {
-                if (extract->node_tracker.get(node_ref.ref())) {
-                    if (debug) {
-                        std::cerr << "way has a node (" << node_ref.ref() << ") inside extract, recording in way_tracker\n";
-                    }
-                    extract->way_tracker.set(way.id());
-                    break;
-                }
-            }
+
+        extract_masks::code_type code = extract_masks::none;
+        for (const auto& node_ref : way.nodes()) {
+            code = info->masks.merge(code, info->node_index.get(node_ref.ref()));
+        }
+
+        if (debug && code != extract_masks::none) {
+            std::cerr << "way has a node inside extracts, recording in way_index\n";
         }
+        info->way_index.add(way.id(), code);
     }
 
     // - walk over all relation-versions
-    //   - walk over all bboxes
-    //     - walk over all relation-members
-    //       - if the relation-member is recorded in the bboxes node- or way-tracker
-    //         - record its id in the bboxes relation-tracker
+    //   - unite the sets of all node- and way-members in the node- and way-index
+    //   - add them to the relation-ids set in the relation-index
     void relation(const osmium::Relation& relation) {
-
-
         if (debug) {
             std::cerr << "simplecut relation " << relation.id() << " v" << relation.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-
-            for (const auto& member : relation.members()) {
-
-                if ((member.type() == osmium::item_type::node && extract->node_tracker.get(member.ref())) ||
-                    (member.type() == osmium::item_type::way && extract->way_tracker.get(member.ref()))) {
-
-                    if (debug) std::cerr << "relation has a member (" << member.type() << " " << member.ref() << ") inside extract, recording in relation_tracker\n";
-
-
-                    extract->relation_tracker.set(relation.id());
-                    break;
-                }     
+        extract_masks::code_type code = extract_masks::none;
+        for (const auto& member : relation.members()) {
+            if (member.type() == osmium::item_type::node) {
+                code = info->masks.merge(code, info->node_index.get(member.ref()));
+            } else if (member.type() == osmium::item_type::way) {
+                code = info->masks.merge(code, info->way_index.get(member.ref()));
             }
         }
+
+        if (debug && code != extract_masks::none) {
+            std::cerr << "relation has a member inside extracts, recording in relation_index\n";
+        }
+        info->relation_index.add(relation.id(), code);
     }
 
 }; // class SimplecutPassOne
@@ -202,54 +169,44 @@ public:
     }
 
     // - walk over all node-versions
-    //   - walk over all bboxes
-    //     - if the node-id is recorded in the bboxes node-tracker or in the extra-node-tracker
-    //       - send the node to the bboxes writer
+    //   - walk over all bboxes in the node-ids set in the node-index
+    //     - send the node to the bboxes writer
     void node(const osmium::Node& node) {
         if (debug) {
             std::cerr << "simplecut node " << node.id() << " v" << node.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->node_tracker.get(node.id())) {
-                extract->write(node);
-            }
-        }
+        info->masks.for_each_extract(info->node_index.get(node.id()), [&](size_t i) {
+            info->extracts[i]->write(node);
+        });
     }
 
     // - walk over all way-versions
-    //   - walk over all bboxes
-    //     - if the way-id is recorded in the bboxes way-tracker
-    //       - send the way to the bboxes writer
+    //   - walk over all bboxes in the way-ids set in the way-index
+    //     - send the way to the bboxes writer
     void way(const osmium::Way& way) {
         if (debug) {
             std::cerr << "simplecut way " << way.id() << " v" << way.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->way_tracker.get(way.id())) {
-                extract->write(way);
-            }
-        }
+        info->masks.for_each_extract(info->way_index.get(way.id()), [&](size_t i) {
+            info->extracts[i]->write(way);
+        });
     }
 
     // - walk over all relation-versions
-    //   - walk over all bboxes
-    //     - if the relation-id is recorded in the bboxes relation-tracker
-    //       - send the relation to the bboxes writer
+    //   - walk over all bboxes in the relation-ids set in the relation-index
+    //     - send the relation to the bboxes writer
     void relation(const osmium::Relation& relation) {
         if (debug) {
             std::cerr << "simplecut relation " << relation.id() << " v" << relation.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->relation_tracker.get(relation.id())) {
-                extract->write(relation);
-            }
-        }
+        info->masks.for_each_extract(info->relation_index.get(relation.id()), [&](size_t i) {
+            info->extracts[i]->write(relation);
+        });
     }
 
 }; // class SimplecutPassTwo
 
 #endif // SPLITTER_SIMPLECUT_HPP
-
@@ -2,7 +2,7 @@
 #define SPLITTER_SOFTCUT_HPP
 
 #include "cut.hpp"
-#include "growing_bitset.hpp"
+#include "id_tracker.hpp"
 
 /*
 
@@ -12,25 +12,12 @@ Softcut Algorithm
      - if the current node-version is inside the bbox
        - record its id in the bboxes node-tracker
 
- - initialize the current-way-id to 0
- - walk over all way-versions
-   - if current-way-id != 0 and current-way-id != the id of the currently iterated way (in other words: this is a different way)
-     - walk over all bboxes
-       - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-         - append all nodes of the current-way-nodes set to the extra-node-tracker
-     - clear the current-way-nodes set
-   - update the current-way-id
-   - walk over all way-nodes
-     - append the node-ids to the current-way-nodes set
+ - walk over all ways, with all versions of a way at once
+   - collect the node-ids of all versions
    - walk over all bboxes
-     - walk over all way-nodes
-       - if the way-node is recorded in the bboxes node-tracker
-         - record its id in the bboxes way-id-tracker
-
-- after all ways
-  - walk over all bboxes
-    - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-      - append all nodes of the current-way-nodes set to the extra-node-tracker
+     - if any of the node-ids is recorded in the bboxes node-tracker
+       - record the way-id in the bboxes way-id-tracker
+       - append all collected node-ids to the extra-node-tracker
 
  - walk over all relation-versions
    - walk over all bboxes
@@ -71,10 +58,10 @@ disadvantages
 class SoftcutExtractInfo : public ExtractInfo {
 
 public:
-    growing_bitset node_tracker;
-    growing_bitset extra_node_tracker;
-    growing_bitset way_tracker;
-    growing_bitset relation_tracker;
+    id_tracker node_tracker;
+    id_tracker extra_node_tracker;
+    id_tracker way_tracker;
+    id_tracker relation_tracker;
 
     SoftcutExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
         ExtractInfo(name, file, header) {}
@@ -90,41 +77,9 @@ public:
 
 class SoftcutPassOne : public Cut<SoftcutInfo> {
 
-    osmium::object_id_type current_way_id;
-    std::set<osmium::object_id_type> current_way_nodes;
-    bool first_relation = true;
-
-    // - walk over all bboxes
-    //   - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //     - append all nodes of the current-way-nodes set to the extra-node-tracker
-    void write_way_extra_nodes() {
-        if (debug) {
-            std::cerr << "finished all versions of way " << current_way_id << ", checking for extra nodes\n";
-        }
-
-        for (const auto& extract : info->extracts) {
-            if (extract->way_tracker.get(current_way_id)) {
-                if (debug) {
-                    std::cerr << "way had a node inside extract, recording extra nodes\n";
-                }
-
-                for (const auto id : current_way_nodes) {
-                    extract->extra_node_tracker.set(id);
-                    if (debug) {
-                        std::cerr << "  " << id;
-                    }
-                }
-
-                if (debug) {
-                    std::cerr << "\n";
-                }
-            }
-        }
-    }
-
 public:
 
-    SoftcutPassOne(SoftcutInfo *info) : Cut<SoftcutInfo>(info), current_way_id(0), current_way_nodes() {
+    SoftcutPassOne(SoftcutInfo *info) : Cut<SoftcutInfo>(info) {
         std::cout << "Start Softcut:\n";
         for (const auto& extract : info->extracts) {
             std::cout << "\textract " << extract->name << "\n";
@@ -138,66 +93,67 @@ public:
     //   - walk over all bboxes
     //     - if the current node-version is inside the bbox
     //       - record its id in the bboxes node-tracker
-    void node(const osmium::Node& node) {
+    //
+    // all versions of a node come in at once, a version is only tested
+    // against the bboxes the versions before it were not inside
+    void node_versions(const version_group<osmium::Node>& versions) {
         if (debug) {
-            std::cerr << "softcut node " << node.id() << " v" << node.version() << "\n";
+            for (const osmium::Node* node : versions) {
+                std::cerr << "softcut node " << node->id() << " v" << node->version() << "\n";
+            }
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->contains(node)) {
-                if (debug) std::cerr << "node is in extract, recording in node_tracker\n";
+        for (const auto& extract : extracts_containing(versions)) {
+            if (debug) std::cerr << "node is in extract, recording in node_tracker\n";
 
-                extract->node_tracker.set(node.id());
-            }
+            extract->node_tracker.set(versions.id());
         }
     }
 
-    // - initialize the current-way-id to 0
     // - walk over all way-versions
-    //   - if current-way-id != 0 and current-way-id != the id of the currently iterated way (in other words: this is a different way)
-    //     - walk over all bboxes
-    //       - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //         - append all nodes of the current-way-nodes set to the extra-node-tracker
-    //     - clear the current-way-nodes set
-    //   - update the current-way-id
-    //   - walk over all way-nodes
-    //     - append the node-ids to the current-way-nodes set
     //   - walk over all bboxes
     //     - walk over all way-nodes
     //       - if the way-node is recorded in the bboxes node-tracker
     //         - record its id in the bboxes way-id-tracker
     //
-    // - after all ways
+    // - after all versions of a way
     //   - walk over all bboxes
     //     - if the way-id is in the bboxes way-id-tracker (in other words: the way is in the output)
-    //       - append all nodes of the current-way-nodes set to the extra-node-tracker
-
-    void way(const osmium::Way& way) {
-        // detect a new way
-        if (current_way_id != 0 && current_way_id != way.id()) {
-            write_way_extra_nodes();
-            current_way_nodes.clear();
-        }
-        current_way_id = way.id();
-
+    //       - append the nodes of all versions to the extra-node-tracker
+    //
+    // all versions of a way come in at once, so every node shared by
+    // several versions is only looked up once
+    void way_versions(const version_group<osmium::Way>& versions) {
         if (debug) {
-            std::cerr << "softcut way " << way.id() << " v" << way.version() << "\n";
+            for (const osmium::Way* way : versions) {
+                std::cerr << "softcut way " << way->id() << " v" << way->version() << "\n";
+            }
         }
 
-        for (const auto& node_ref : way.nodes()) {
-            current_way_nodes.insert(node_ref.ref());
-        }
+        collect_node_ids(versions);
 
-        for (const auto& extract : info->extracts) {
-            for (const auto& node_ref : way.nodes()) {
-                if (extract->node_tracker.get(node_ref.ref())) {
-                    if (debug) {
-                        std::cerr << "way has a node (" << node_ref.ref() << ") inside extract, recording in way_tracker\n";
-                    }
-                    extract->way_tracker.set(way.id());
-                    break;
-                }
+        // a way with no node inside an extract has none inside the extracts
+        // nested in it either
+        for_each_nested([this, &versions](SoftcutExtractInfo* extract) -> bool {
+            if (!extract->node_tracker.get_any(m_node_ids)) {
+                return false;
+            }
+
+            if (debug) {
+                std::cerr << "way has a node inside extract, recording in way_tracker and extra nodes\n";
             }
+            extract->way_tracker.set(versions.id());
+
+            for (const auto id : m_node_ids) {
+                extract->extra_node_tracker.set(id);
+            }
+            return true;
+        });
+    }
+
+    void relation_versions(const version_group<osmium::Relation>& versions) {
+        for (const osmium::Relation* version : versions) {
+            relation(*version);
         }
     }
 
@@ -207,32 +163,22 @@ public:
     //       - if the relation-member is recorded in the bboxes node- or way-tracker
     //         - record its id in the bboxes relation-tracker
     void relation(const osmium::Relation& relation) {
-        if (first_relation) {
-            write_way_extra_nodes();
-            first_relation = false;
-        }
-
         if (debug) {
             std::cerr << "softcut relation " << relation.id() << " v" << relation.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            bool hit = false;
-
-            for (const auto& member : relation.members()) {
-
-                if (!hit && (
-                    (member.type() == osmium::item_type::node && extract->node_tracker.get(member.ref())) ||
-                    (member.type() == osmium::item_type::way && extract->way_tracker.get(member.ref())) ||
-                    (member.type() == osmium::item_type::relation && extract->relation_tracker.get(member.ref()))
-                )) {
-
-                    if (debug) std::cerr << "relation has a member (" << member.type() << " " << member.ref() << ") inside extract, recording in relation_tracker\n";
-                    hit = true;
+        for_each_nested([this, &relation](SoftcutExtractInfo* extract) -> bool {
+            const bool hit =
+                extract->node_tracker.get_any(relation.members(), osmium::item_type::node) ||
+                extract->way_tracker.get_any(relation.members(), osmium::item_type::way) ||
+                extract->relation_tracker.get_any(relation.members(), osmium::item_type::relation);
 
-                    extract->relation_tracker.set(relation.id());
-                }
+            if (hit) {
+                if (debug) std::cerr << "relation has a member inside extract, recording in relation_tracker\n";
+                extract->relation_tracker.set(relation.id());
+            }
 
+            for (const auto& member : relation.members()) {
                 if (member.type() == osmium::item_type::relation) {
                     if (debug) {
                         std::cerr << "recording cascading-pair: " << member.ref() << " -> " << relation.id() << "\n";
@@ -244,7 +190,8 @@ public:
             if (hit) {
                 cascading_relations(extract, relation.id());
             }
-        }
+            return hit || extract->relation_tracker.get(relation.id());
+        });
     }
 
     void cascading_relations(SoftcutExtractInfo *extract, osmium::object_id_type id) {
@@ -275,23 +222,55 @@ public:
             std::cerr << "\n\n=====softcut second-pass=====\n\n";
         }
 
+        // the first pass is done with both node trackers, merge them so
+        // every node-version needs only one lookup per extract
+        for (const auto& extract : info->extracts) {
+            extract->node_tracker |= extract->extra_node_tracker;
+            extract->extra_node_tracker.clear();
+
+            info->node_blocks |= extract->node_tracker.summary();
+            info->way_blocks |= extract->way_tracker.summary();
+            info->relation_blocks |= extract->relation_tracker.summary();
+        }
+    }
+
+    // only the blobs of the input holding a recorded object are read
+    bool wants(osmium::item_type type, osmium::object_id_type first, osmium::object_id_type last) const {
+        return info->recorded(type, first, last);
+    }
+
+    bool selects(const SoftcutExtractInfo* extract, const osmium::Node& node) const {
+        return extract->node_tracker.get(node.id());
+    }
+
+    bool selects(const SoftcutExtractInfo* extract, const osmium::Way& way) const {
+        return extract->way_tracker.get(way.id());
+    }
+
+    bool selects(const SoftcutExtractInfo* extract, const osmium::Relation& relation) const {
+        return extract->relation_tracker.get(relation.id());
     }
 
     // - walk over all node-versions
     //   - walk over all bboxes
-    //     - if the node-id is recorded in the bboxes node-tracker or in the extra-node-tracker
+    //     - if the node-id is recorded in the bboxes node-tracker (which now includes the extra-node-tracker)
     //       - send the node to the bboxes writer
     void node(const osmium::Node& node) {
         if (debug) {
             std::cerr << "softcut node " << node.id() << " v" << node.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->node_tracker.get(node.id()) ||
-                extract->extra_node_tracker.get(node.id())) {
-                extract->write(node);
-            }
+        if (!info->node_blocks.get(node.id())) {
+            return;
         }
+
+        for_each_nested([this, &node](SoftcutExtractInfo* extract) -> bool {
+            if (!selects(extract, node)) {
+                return false;
+            }
+            extract->write(node);
+            return true;
+        });
     }
 
     // - walk over all way-versions
@@ -303,11 +282,17 @@ public:
             std::cerr << "softcut way " << way.id() << " v" << way.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->way_tracker.get(way.id())) {
-                extract->write(way);
-            }
+        if (!info->way_blocks.get(way.id())) {
+            return;
         }
+
+        for_each_nested([this, &way](SoftcutExtractInfo* extract) -> bool {
+            if (!selects(extract, way)) {
+                return false;
+            }
+            extract->write(way);
+            return true;
+        });
     }
 
     // - walk over all relation-versions
@@ -319,11 +304,17 @@ public:
             std::cerr << "softcut relation " << relation.id() << " v" << relation.version() << "\n";
         }
 
-        for (const auto& extract : info->extracts) {
-            if (extract->relation_tracker.get(relation.id())) {
-                extract->write(relation);
-            }
+        if (!info->relation_blocks.get(relation.id())) {
+            return;
         }
+
+        for_each_nested([this, &relation](SoftcutExtractInfo* extract) -> bool {
+            if (!selects(extract, relation)) {
+                return false;
+            }
+            extract->write(relation);
+            return true;
+        });
     }
 
 }; // class SoftcutPassTwo
@@ -0,0 +1,280 @@
+#ifndef SPLITTER_SPLICE_WRITER_HPP
+#define SPLITTER_SPLICE_WRITER_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include "pbf_index.hpp"
+
+/**
+ * The writer of an extract: an osmium Writer on the output file, into
+ * which raw blobs of a PBF input can be spliced between the objects
+ * written through it.
+ *
+ * osmium's Writer encodes on threads of its own, and only close() waits
+ * until all it was handed is in the file. So before the first raw blob
+ * the Writer is closed and the file is opened again for appending. The
+ * objects after a raw blob go to a new Writer writing into a pipe, and a
+ * thread copies the data blobs from the pipe to the file, leaving out the
+ * header blob every Writer starts with. That Writer is closed again
+ * before the next raw blob.
+ *
+ * SIGPIPE has to be ignored, like for the blob_feed.
+ */
+class splice_writer {
+
+    osmium::io::File m_file;
+    osmium::io::Header m_header;
+
+    // where objects go, nullptr after a raw blob until the next object
+    std::unique_ptr<osmium::io::Writer> m_writer;
+
+    // the output file, once raw blobs are appended to it
+    int m_fd;
+
+    // read end of the pipe the current Writer writes into, and the thread
+    // copying from it to m_fd
+    int m_pipe;
+    std::thread m_relay;
+    bool m_relay_failed;
+
+    static bool read_all(int fd, char* data, size_t size, bool& end) {
+        end = false;
+        size_t done = 0;
+        while (done < size) {
+            const ssize_t n = ::read(fd, data + done, size - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (n == 0) {
+                end = (done == 0);
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    static bool write_all(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            const ssize_t n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // copy what the Writer writes into the pipe to the file, blob by blob,
+    // without the header blob
+    void relay() {
+        std::string blob;
+        std::string type;
+        uint64_t data_size;
+        bool end;
+        char length_bytes[4];
+
+        while (!m_relay_failed) {
+            if (!read_all(m_pipe, length_bytes, 4, end)) {
+                m_relay_failed = !end;
+                break;
+            }
+            const uint32_t header_size =
+                (uint32_t(static_cast<unsigned char>(length_bytes[0])) << 24) |
+                (uint32_t(static_cast<unsigned char>(length_bytes[1])) << 16) |
+                (uint32_t(static_cast<unsigned char>(length_bytes[2])) << 8) |
+                uint32_t(static_cast<unsigned char>(length_bytes[3]));
+            if (header_size > pbf_index::max_header_size) {
+                m_relay_failed = true;
+                break;
+            }
+
+            blob.assign(length_bytes, 4);
+            blob.resize(4 + header_size);
+            if (!read_all(m_pipe, &blob[4], header_size, end) ||
+                !pbf_index::blob_header(blob.data() + 4, header_size, type, data_size)) {
+                m_relay_failed = true;
+                break;
+            }
+
+            blob.resize(4 + header_size + data_size);
+            if (!read_all(m_pipe, &blob[4 + header_size], data_size, end)) {
+                m_relay_failed = true;
+                break;
+            }
+
+            if (type != "OSMHeader" && !write_all(m_fd, blob.data(), blob.size())) {
+                std::cerr << "error writing to " << m_file.filename() << ": " << strerror(errno) << "\n";
+                m_relay_failed = true;
+            }
+        }
+
+        // a Writer blocked on a full pipe must still get to its end
+        char drain[65536];
+        while (::read(m_pipe, drain, sizeof(drain)) > 0) {
+        }
+    }
+
+    // start a Writer writing into a pipe, for the objects after a raw blob
+    void open_segment() {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::system_error(errno, std::system_category(), "can't create pipe for " + m_file.filename());
+        }
+        m_pipe = fds[0];
+        m_relay_failed = false;
+        m_relay = std::thread(&splice_writer::relay, this);
+
+        // the same options and history flag as the output file, which the
+        // name /dev/fd/N doesn't tell osmium
+        osmium::io::File segment("/dev/fd/" + std::to_string(fds[1]), "pbf");
+        for (const auto& option : m_file) {
+            segment.set(option.first, option.second);
+        }
+        segment.set_has_multiple_object_versions(m_file.has_multiple_object_versions());
+
+        try {
+            m_writer.reset(new osmium::io::Writer(segment, m_header, osmium::io::overwrite::allow));
+        } catch (...) {
+            ::close(fds[1]);
+            throw;
+        }
+
+        // the Writer opened a descriptor of its own, closing it ends the
+        // relay
+        ::close(fds[1]);
+    }
+
+    // close the Writer and wait until all it was handed is in the file
+    bool close_writer() {
+        if (m_writer) {
+            m_writer->close();
+            m_writer.reset();
+        }
+
+        if (m_relay.joinable()) {
+            m_relay.join();
+            ::close(m_pipe);
+            m_pipe = -1;
+            if (m_relay_failed) {
+                std::cerr << "error copying blobs to " << m_file.filename() << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+
+    splice_writer(const osmium::io::File& file, const osmium::io::Header& header) :
+        m_file(file),
+        m_header(header),
+        m_writer(new osmium::io::Writer(file, header)),
+        m_fd(-1),
+        m_pipe(-1),
+        m_relay(),
+        m_relay_failed(false) {
+    }
+
+    ~splice_writer() {
+        // the Writer closes itself, which ends the relay
+        m_writer.reset();
+        if (m_relay.joinable()) m_relay.join();
+        if (m_pipe >= 0) ::close(m_pipe);
+        if (m_fd >= 0) ::close(m_fd);
+    }
+
+    splice_writer(const splice_writer&) = delete;
+    splice_writer& operator=(const splice_writer&) = delete;
+
+    /**
+     * can raw blobs of an input whose header requires required_features be
+     * spliced in? only into a PBF file whose header requires the same, and
+     * with blobs that mean the same in it.
+     */
+    bool takes(const std::vector<std::string>& required_features) const {
+        if (m_file.format() != osmium::io::file_format::pbf ||
+            m_file.filename().empty() || m_file.filename() == "-" ||
+            m_file.is_true("locations_on_ways")) {
+            return false;
+        }
+
+        bool history = false;
+        for (const auto& feature : required_features) {
+            if (feature == "HistoricalInformation") {
+                history = true;
+            } else if (feature == "DenseNodes") {
+                if (m_file.is_false("pbf_dense_nodes")) return false;
+            } else if (feature != "OsmSchema-V0.6") {
+                return false;
+            }
+        }
+        return history == (m_file.has_multiple_object_versions() || m_header.has_multiple_object_versions());
+    }
+
+    void operator()(osmium::memory::Buffer&& buffer) {
+        if (!m_writer) {
+            if (buffer.committed() == 0) {
+                return;
+            }
+            open_segment();
+        }
+        (*m_writer)(std::move(buffer));
+    }
+
+    /**
+     * append the raw blob data, of size bytes, after all objects written
+     * so far. returns false if that fails, the file is broken then.
+     */
+    bool splice(const char* data, size_t size) {
+        if (!close_writer()) {
+            return false;
+        }
+
+        if (m_fd < 0) {
+            m_fd = ::open(m_file.filename().c_str(), O_WRONLY | O_APPEND);
+            if (m_fd < 0) {
+                std::cerr << "can't open " << m_file.filename() << " to append to it: " << strerror(errno) << "\n";
+                return false;
+            }
+        }
+
+        if (!write_all(m_fd, data, size)) {
+            std::cerr << "error writing to " << m_file.filename() << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        const bool closed = close_writer();
+        if (m_fd >= 0) {
+            if (::close(m_fd) != 0 && closed) {
+                std::cerr << "error writing to " << m_file.filename() << ": " << strerror(errno) << "\n";
+            }
+            m_fd = -1;
+        }
+    }
+
+}; // class splice_writer
+
+#endif // SPLITTER_SPLICE_WRITER_HPP
@@ -1,10 +1,17 @@
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <getopt.h>
+#include <memory>
 #include <string>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/file.hpp>
@@ -21,96 +28,498 @@
 #include "hardcut.hpp"
 #include "supersoftercut.hpp"
 #include "simplecut.hpp"
+#include "segment_storage.hpp"
+#include "geometry_cache.hpp"
+#include "blob_feed.hpp"
+#include "input_cache.hpp"
+#include "node_classifier.hpp"
+#include "pbf_index.hpp"
+#include "version_grouper.hpp"
+#include "worker_pool.hpp"
+
+// one line of the config file. the strings point into the buffer holding
+// the whole file.
+struct config_entry {
+    const char *name;
+    char type;
+    const char *spec;
+    const char *parent;
+    std::unique_ptr<fixed_point_polygon> polygon;
+    std::unique_ptr<polygon_raster> raster;
+
+    // the extract is skipped, its polygon or the one of a parent couldn't
+    // be loaded
+    bool failed;
+};
+
+// split the next token off a line, terminating it in place. returns
+// nullptr at the end of the line.
+char *next_token(char*& pos) {
+    while (*pos == ' ' || *pos == '\t' || *pos == '\r') {
+        pos++;
+    }
+    if (*pos == '\0') {
+        return nullptr;
+    }
 
-template <typename TExtractInfo>
-bool readConfig(const std::string& conffile, CutInfo<TExtractInfo> &info) {
-    const int linelen = 4096;
+    char *token = pos;
+    while (*pos != '\0' && *pos != ' ' && *pos != '\t' && *pos != '\r') {
+        pos++;
+    }
+    if (*pos != '\0') {
+        *pos++ = '\0';
+    }
+    return token;
+}
 
+// parse count comma separated numbers
+bool parse_numbers(const char *spec, double *values, int count) {
+    for (int i = 0; i < count; i++) {
+        char *end;
+        values[i] = strtod(spec, &end);
+        if (end == spec || (i < count-1 && *end != ',') || (i == count-1 && *end != '\0')) {
+            return false;
+        }
+        spec = end + 1;
+    }
+    return true;
+}
+
+// read and prepare the polygon of a POLY or OSM extract, from the
+// geometry_cache if it was prepared before
+void load_polygon(config_entry& entry) {
+    fixed_point_polygon *polygon = nullptr;
+    polygon_raster *raster = nullptr;
+    if (!geometry_cache::instance().load(entry.spec, entry.type, polygon, raster)) {
+        geos::geom::Geometry *geom = (entry.type == 'p') ?
+            OsmiumExtension::GeometryReader::fromPolyFile(entry.spec) :
+            OsmiumExtension::GeometryReader::fromOsmFile(entry.spec);
+        if (!geom) {
+            std::cerr << "error creating geometry from " << (entry.type == 'p' ? "poly" : "osm") << "-file " << entry.spec << " for " << entry.name << "\n";
+            entry.failed = true;
+            return;
+        }
+        polygon = new fixed_point_polygon(*geom);
+        raster = new polygon_raster(*polygon);
+        OsmiumExtension::geos_factory()->destroyGeometry(geom);
+        geometry_cache::instance().store(entry.spec, entry.type, *polygon, *raster);
+    }
+    entry.polygon.reset(polygon);
+    entry.raster.reset(raster);
+}
+
+template <typename TExtractInfo>
+bool readConfig(const std::string& conffile, CutInfo<TExtractInfo> &info, bool partition, size_t threads) {
     FILE *fp = fopen(conffile.c_str(), "r");
     if (!fp) {
         std::cerr << "unable to open config file " << conffile << "\n";
         return false;
     }
 
-    char line[linelen];
-    while (fgets(line, linelen-1, fp)) {
-        line[linelen-1] = '\0';
-        if (line[0] == '#' || line[0] == '\r' || line[0] == '\n' || line[0] == '\0')
+    std::string buffer;
+    char chunk[65536];
+    size_t size;
+    while ((size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        buffer.append(chunk, size);
+    }
+    fclose(fp);
+
+    std::vector<config_entry> entries;
+    char *pos = &buffer[0];
+    while (*pos != '\0') {
+        char *line = pos;
+        while (*pos != '\0' && *pos != '\n') {
+            pos++;
+        }
+        if (*pos != '\0') {
+            *pos++ = '\0';
+        }
+
+        if (line[0] == '#' || line[0] == '\r' || line[0] == '\0')
             continue;
 
-        int n = 0;
-        char *tok = strtok(line, "\t ");
-
-        const char *name = nullptr;
-        double minlon = 0, minlat = 0, maxlon = 0, maxlat = 0;
-        char type = '\0';
-        char file[linelen];
-
-        while (tok) {
-            switch(n) {
-                case 0:
-                    name = tok;
-                    break;
-
-                case 1:
-                    if (0 == strcmp("BBOX", tok))
-                        type = 'b';
-                    else if (0 == strcmp("POLY", tok))
-                        type = 'p';
-                    else if (0 == strcmp("OSM", tok))
-                        type = 'o';
-                    else {
-                        type = '\0';
-                        std::cerr << "output " << name << " of type " << tok << ": unknown output type\n";
-                        return false;
+        config_entry entry = config_entry();
+        entry.name = next_token(line);
+        const char *type = next_token(line);
+        entry.spec = next_token(line);
+        entry.parent = next_token(line);
+
+        if (!entry.spec) {
+            continue;
+        }
+
+        if (0 == strcmp("BBOX", type))
+            entry.type = 'b';
+        else if (0 == strcmp("POLY", type))
+            entry.type = 'p';
+        else if (0 == strcmp("OSM", type))
+            entry.type = 'o';
+        else {
+            std::cerr << "output " << entry.name << " of type " << type << ": unknown output type\n";
+            return false;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    // reading and preparing the polygons is independent per extract
+    std::atomic<size_t> next(0);
+    worker_pool pool(std::max<size_t>(1, std::min(threads, entries.size())));
+    pool.run([&](size_t) {
+        size_t i;
+        while ((i = next++) < entries.size()) {
+            if (entries[i].type != 'b') {
+                load_polygon(entries[i]);
+            }
+        }
+    });
+
+    // the writers are opened in the order of the config
+    for (auto& entry : entries) {
+        if (entry.failed) {
+            continue;
+        }
+
+        TExtractInfo *parent = nullptr;
+        if (entry.parent) {
+            for (const auto& extract : info.extracts) {
+                if (extract->name == entry.parent) {
+                    parent = extract;
+                }
+            }
+            if (!parent) {
+                // an extract whose polygon failed is skipped, and so are
+                // the extracts nested in it
+                bool parent_failed = false;
+                for (const auto& other : entries) {
+                    if (&other == &entry) {
+                        break;
                     }
-                    break;
-
-                case 2:
-                    switch(type) {
-                        case 'b':
-                            if (4 == sscanf(tok, "%lf,%lf,%lf,%lf", &minlon, &minlat, &maxlon, &maxlat)) {
-                                info.addExtract(name, minlat, minlon, maxlat, maxlon);
-                            } else {
-                                std::cerr << "error reading BBOX " << tok << " for " << name << "\n";
-                                return false;
-                            }
-                            break;
-                        case 'p':
-                            if (1 == sscanf(tok, "%s", file)) {
-                                geos::geom::Geometry *geom = OsmiumExtension::GeometryReader::fromPolyFile(file);
-                                if (!geom) {
-                                    std::cerr << "error creating geometry from poly-file " << file << " for " << name << "\n";
-                                    break;
-                                }
-                                info.addExtract(name, geom);
-                            }
-                            break;
-                        case 'o':
-                            if (1 == sscanf(tok, "%s", file)) {
-                                geos::geom::Geometry *geom = OsmiumExtension::GeometryReader::fromOsmFile(file);
-                                if (!geom) {
-                                    std::cerr << "error creating geometry from poly-file " << file << " for " << name << "\n";
-                                    break;
-                                }
-                                info.addExtract(name, geom);
-                            }
-                            break;
+                    if (other.failed && 0 == strcmp(other.name, entry.parent)) {
+                        parent_failed = true;
                     }
-                    break;
+                }
+                if (parent_failed) {
+                    std::cerr << "parent " << entry.parent << " of " << entry.name << " could not be loaded, skipping " << entry.name << "\n";
+                    entry.failed = true;
+                    continue;
+                }
+
+                std::cerr << "parent " << entry.parent << " of " << entry.name << " must be listed before it\n";
+                return false;
             }
+        }
 
-            tok = strtok(nullptr, "\t ");
-            n++;
+        if (entry.type == 'b') {
+            double bbox[4];
+            if (!parse_numbers(entry.spec, bbox, 4)) {
+                std::cerr << "error reading BBOX " << entry.spec << " for " << entry.name << "\n";
+                return false;
+            }
+            info.addExtract(entry.name, bbox[1], bbox[0], bbox[3], bbox[2], parent);
+        } else if (entry.polygon) {
+            info.addExtract(entry.name, entry.polygon.release(), entry.raster.release(), parent);
         }
     }
-    fclose(fp);
+
+    info.arrange(partition);
+    return true;
+}
+
+// the input of a cut, and what the later passes read instead of all of it
+struct cut_input {
+    osmium::io::File file;
+    std::string filename;
+
+    // blobs of a PBF input, built while the first pass runs
+    pbf_index index;
+
+    // the buffers of the first pass, if the later passes replay them
+    std::unique_ptr<input_cache> cache;
+
+    cut_input(const std::string& name) :
+        file(name),
+        filename(name),
+        index(),
+        cache() {
+    }
+};
+
+// reads the first pass over the input. with an input cache every entity
+// type is read and each buffer is kept for the later passes.
+class pass_reader {
+
+    osmium::io::Reader m_reader;
+    input_cache* m_cache;
+
+public:
+
+    pass_reader(const cut_input& input, osmium::osm_entity_bits::type entities) :
+        m_reader(input.file, input.cache ? osmium::osm_entity_bits::nwr : entities),
+        m_cache(input.cache.get()) {
+    }
+
+    osmium::memory::Buffer read() {
+        osmium::memory::Buffer buffer = m_reader.read();
+        if (m_cache && buffer) {
+            m_cache->add(buffer);
+        }
+        return buffer;
+    }
+
+    void close() {
+        m_reader.close();
+        if (m_cache) {
+            m_cache->finish();
+        }
+    }
+
+}; // class pass_reader
+
+// run a pass over all of the input, reading only the entity types the
+// pass looks at
+template <typename THandler>
+void apply_pass(const cut_input& input, THandler& handler) {
+    pass_reader reader(input, THandler::entities());
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        osmium::apply(buffer, handler);
+    }
+    reader.close();
+}
+
+// run a pass whose node() classifies nodes, with the classification
+// spread over threads threads
+template <typename TCutInfo, typename THandler>
+void apply_first_pass(const cut_input& input, TCutInfo& info, THandler& handler, size_t threads) {
+    pass_reader reader(input, THandler::entities());
+
+    std::unique_ptr<NodeClassifier<TCutInfo>> classifier;
+    if (threads > 1) {
+        classifier.reset(new NodeClassifier<TCutInfo>(info, threads));
+    }
+
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        if (classifier) {
+            classifier->apply(buffer, handler);
+        } else {
+            osmium::apply(buffer, handler);
+        }
+    }
+
+    reader.close();
+}
+
+// run a pass that takes all versions of an object at once, with the
+// classification of the nodes spread over threads threads
+template <typename TCutInfo, typename THandler>
+void apply_grouped_pass(const cut_input& input, TCutInfo& info, THandler& handler, size_t threads) {
+    pass_reader reader(input, THandler::entities());
+
+    std::unique_ptr<NodeClassifier<TCutInfo>> classifier;
+    if (threads > 1) {
+        classifier.reset(new NodeClassifier<TCutInfo>(info, threads));
+    }
+
+    VersionGrouper<TCutInfo> grouper(classifier.get());
+    grouper.apply(reader, handler);
+
+    reader.close();
+}
+
+// index the blobs of a PBF input on a thread of its own, while the first
+// pass reads it. this reads and inflates all of the input a second time,
+// so it is left out when the later passes can't use the index: for other
+// inputs, inputs replayed from the cache and configs without extracts.
+template <typename TCutInfo>
+std::thread index_input(cut_input& input, const TCutInfo& info) {
+    if (input.cache || info.extracts.empty() || input.file.format() != osmium::io::file_format::pbf) {
+        return std::thread();
+    }
+    return std::thread([&input]() {
+        if (!input.index.build(input.filename)) {
+            std::cerr << "can't index " << input.filename << ", later passes read all of it\n";
+        }
+    });
+}
+
+// does a part of the input with the ids in ids hold objects of an entity
+// type the pass looks at, with ids the pass wants?
+template <typename THandler>
+bool blob_wanted(const id_ranges& ids, const THandler& handler) {
+    static const osmium::item_type types[3] = {
+        osmium::item_type::node,
+        osmium::item_type::way,
+        osmium::item_type::relation
+    };
+
+    for (size_t t = 0; t < 3; t++) {
+        if (ids.has(t) &&
+            (THandler::entities() & osmium::osm_entity_bits::from_item_type(types[t])) &&
+            handler.wants(types[t], ids.first[t], ids.last[t])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// does the pass write every object of buffer to extract?
+template <typename THandler>
+bool selects_all(const THandler& handler, const typename THandler::extract_info_type* extract, const osmium::memory::Buffer& buffer) {
+    for (const auto& item : buffer) {
+        switch (item.type()) {
+            case osmium::item_type::node:
+                if (!handler.selects(extract, static_cast<const osmium::Node&>(item))) return false;
+                break;
+            case osmium::item_type::way:
+                if (!handler.selects(extract, static_cast<const osmium::Way&>(item))) return false;
+                break;
+            case osmium::item_type::relation:
+                if (!handler.selects(extract, static_cast<const osmium::Relation&>(item))) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// does buffer hold the objects of blob? the ids and the number of objects
+// of both have to match.
+bool buffer_of(const osmium::memory::Buffer& buffer, const pbf_index::blob& blob) {
+    id_ranges ids;
+    ids.clear();
+    uint64_t objects = 0;
+    for (const auto& item : buffer) {
+        if (item.type() == osmium::item_type::node || item.type() == osmium::item_type::way || item.type() == osmium::item_type::relation) {
+            ids.extend(id_ranges::type_index(item.type()), static_cast<const osmium::OSMObject&>(item).id());
+            objects++;
+        }
+    }
+
+    if (objects != blob.objects) {
+        return false;
+    }
+    for (size_t t = 0; t < 3; t++) {
+        if (ids.first[t] != blob.first[t] || ids.last[t] != blob.last[t]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// run a later pass. from the input cache, or with an index of the input,
+// only the buffers or blobs holding objects of the entity types the pass
+// looks at and that handler.wants() are read.
+//
+// with an index, a blob all of whose objects the pass selects for an
+// extract is copied to it unchanged, if its output takes the blobs of the
+// input, instead of having its objects encoded again.
+template <typename THandler>
+bool apply_later_pass(const cut_input& input, THandler& handler) {
+    auto wanted = [&handler](const id_ranges& ids) {
+        return blob_wanted(ids, handler);
+    };
+
+    if (input.cache) {
+        if (!input.cache->replay(handler, wanted)) {
+            std::cerr << "error replaying the input cache\n";
+            return false;
+        }
+        return true;
+    }
+
+    blob_feed feed;
+    const bool indexed = input.index.valid() && feed.open(input.filename, input.index, wanted);
+
+    // the buffers of a pass not reading every entity type lack some of
+    // the objects of their blobs
+    typedef typename THandler::extract_info_type extract_info_type;
+    std::vector<extract_info_type*> targets;
+    std::vector<std::string> features;
+    if (indexed && THandler::entities() == osmium::osm_entity_bits::nwr && input.index.required_features(features)) {
+        for (const auto& extract : handler.extracts()) {
+            if (extract->writer.takes(features)) {
+                targets.push_back(extract);
+            }
+        }
+    }
+
+    osmium::io::Reader reader(indexed ? feed.file() : input.file, THandler::entities());
+    if (targets.empty()) {
+        osmium::apply(reader, handler);
+        reader.close();
+        return true;
+    }
+
+    std::vector<extract_info_type*> spliced;
+    std::string data;
+    size_t next = 0;
+    uint64_t copied = 0;
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        spliced.clear();
+
+        // buffers come in the order of the blobs. if one doesn't match its
+        // blob, which one it is isn't known any more, and the rest of the
+        // pass writes all objects.
+        if (!targets.empty()) {
+            const auto& blobs = feed.blobs();
+            if (next < blobs.size() && buffer_of(buffer, blobs[next])) {
+                for (const auto& extract : targets) {
+                    if (selects_all(handler, extract, buffer)) {
+                        spliced.push_back(extract);
+                    }
+                }
+                if (!spliced.empty() && !feed.read(blobs[next], data)) {
+                    return false;
+                }
+                for (const auto& extract : spliced) {
+                    if (!extract->splice(data.data(), data.size())) {
+                        return false;
+                    }
+                    extract->passed_through = true;
+                    copied++;
+                }
+                next++;
+            } else {
+                targets.clear();
+            }
+        }
+
+        osmium::apply(buffer, handler);
+
+        for (const auto& extract : spliced) {
+            extract->passed_through = false;
+        }
+    }
+    reader.close();
+
+    if (copied > 0) {
+        std::cerr << "copied " << copied << " blobs of " << input.filename << " to extracts unchanged\n";
+    }
+    return true;
+}
+
+// after the first pass: a cache that failed is dropped, the later passes
+// then read the input again. returns false if that is not possible.
+bool check_cache(cut_input& input) {
+    if (!input.cache || !input.cache->failed()) {
+        return true;
+    }
+    input.cache.reset();
+    if (input.filename == "-") {
+        std::cerr << "the input cache failed and stdin can't be read again\n";
+        return false;
+    }
+    std::cerr << "the input cache failed, later passes read " << input.filename << " again\n";
     return true;
 }
 
 int main(int argc, char *argv[]) {
     int cut_algoritm = 3;
     bool debug = false;
+    size_t threads = 1;
+    bool partition = false;
+    long cache_mb = -1;
 
     static struct option long_options[] = {
         {"debug",   no_argument, 0, 'd'},
@@ -122,11 +531,17 @@ int main(int argc, char *argv[]) {
         {"cut_all_borders", no_argument, 0, 'b'},
         {"supersoftercut", no_argument, 0, 'e'},
         {"simplecut", no_argument, 0, 'p'},
+        {"scratch-dir", required_argument, 0, 'S'},
+        {"threads", required_argument, 0, 't'},
+        {"partition", no_argument, 0, 'P'},
+        {"geometry-cache", required_argument, 0, 'G'},
+        {"huge-pages", no_argument, 0, 'H'},
+        {"input-cache", required_argument, 0, 'C'},
         {0, 0, 0, 0}
     };
 
     while (true) {
-        int c = getopt_long(argc, argv, "dshrcwbep", long_options, 0);
+        int c = getopt_long(argc, argv, "dshrcwbepS:t:PG:HC:", long_options, 0);
         if (c == -1)
             break;
 
@@ -158,6 +573,38 @@ int main(int argc, char *argv[]) {
             case 'p':
                 cut_algoritm = 8;
                 break;
+            case 'S':
+                if (!segment_storage::instance().set_directory(optarg)) {
+                    return 1;
+                }
+                break;
+            case 't':
+                if (atoi(optarg) < 1) {
+                    std::cerr << "--threads needs a number of threads >= 1\n";
+                    return 1;
+                }
+                threads = atoi(optarg);
+                break;
+            case 'P':
+                partition = true;
+                break;
+            case 'G':
+                if (!geometry_cache::instance().set_directory(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'H':
+                segment_storage::instance().set_huge_pages(true);
+                break;
+            case 'C': {
+                char *end;
+                cache_mb = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || cache_mb < 0) {
+                    std::cerr << "--input-cache needs a size in MB >= 0\n";
+                    return 1;
+                }
+                break;
+            }
 
         }
     }
@@ -170,190 +617,231 @@ int main(int argc, char *argv[]) {
     std::string filename{argv[optind]};
     std::string conffile{argv[optind+1]};
 
-    if ((cut_algoritm == 1 || cut_algoritm == 3 || cut_algoritm == 4 || cut_algoritm == 5 || cut_algoritm == 6 || cut_algoritm == 7 || cut_algoritm == 8) && filename == "-") {
-        std::cerr << "Can't read from stdin when in softcut, softercut, cut_administrative, cut_water, cut_all_borders, simplecut or supersoftercut\n";
-        return 1;
-    }
+    cut_input input(filename);
 
-    osmium::io::File infile(filename);
+    // a blob_feed whose reader stops early gets EPIPE instead of killing
+    // the process
+    signal(SIGPIPE, SIG_IGN);
+
+    // stdin can only be read once, the later passes replay it from the
+    // input cache
+    if (cut_algoritm != 2 && filename == "-" && cache_mb < 0) {
+        cache_mb = 1024;
+    }
+    if (cut_algoritm != 2 && cache_mb >= 0) {
+        std::string directory = segment_storage::instance().directory();
+        if (directory.empty()) {
+            const char *tmpdir = getenv("TMPDIR");
+            directory = tmpdir ? tmpdir : "/tmp";
+        }
+        input.cache.reset(new input_cache(size_t(cache_mb) * 1024 * 1024, directory));
+    }
 
     if (cut_algoritm == 1) {
         SoftcutInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
 
+        std::thread indexer = index_input(input, info);
         {
             SoftcutPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_grouped_pass(input, info, one, threads);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             SoftcutPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
 
     } else if (cut_algoritm == 2) {
         HardcutInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
 
         Hardcut cutter(&info);
         cutter.debug = debug;
-        osmium::io::Reader reader(infile);
-        osmium::apply(reader, cutter);
-        reader.close();
+        apply_first_pass(input, info, cutter, threads);
 
     } else if (cut_algoritm == 3) {
         SoftercutInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
+        std::thread indexer = index_input(input, info);
         {
             SoftercutPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_grouped_pass(input, info, one, threads);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             SoftercutPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
 
         {
             SoftercutPassThree three(&info);
             three.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, three);
-            reader.close();
+            if (!apply_later_pass(input, three)) {
+                return 1;
+            }
         }
     }else if (cut_algoritm == 4) {
         Cut_administrativeInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
+        std::thread indexer = index_input(input, info);
         {
             Cut_administrativePassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_pass(input, one);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             Cut_administrativePassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
         {
             Cut_administrativePassThree three(&info);
             three.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, three);
-            reader.close();
+            if (!apply_later_pass(input, three)) {
+                return 1;
+            }
         }
     }
     else if (cut_algoritm == 5) {
         Cut_waterInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
+        std::thread indexer = index_input(input, info);
         {
             Cut_waterPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_pass(input, one);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             Cut_waterPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
     }
     else if (cut_algoritm == 6) {
         Cut_all_bordersInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
+        std::thread indexer = index_input(input, info);
         {
             Cut_all_bordersPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_pass(input, one);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             Cut_all_bordersPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
         {
             Cut_all_bordersPassThree three(&info);
             three.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, three);
-            reader.close();
+            if (!apply_later_pass(input, three)) {
+                return 1;
+            }
         }
     }
     else if (cut_algoritm == 7) {
         SuperSoftercutInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
+        std::thread indexer = index_input(input, info);
         {
             SuperSoftercutPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_grouped_pass(input, info, one, threads);
+        }
+        if (indexer.joinable()) {
+            indexer.join();
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             SuperSoftercutPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
         {
             SuperSoftercutPassThree three(&info);
             three.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, three);
-            reader.close();
+            if (!apply_later_pass(input, three)) {
+                return 1;
+            }
         }
     }
     else if (cut_algoritm == 8) {
         SimplecutInfo info;
-        if (!readConfig(conffile, info)) {
+        if (!readConfig(conffile, info, partition, threads)) {
             std::cerr << "error reading config\n";
             return 1;
         }
@@ -361,17 +849,18 @@ int main(int argc, char *argv[]) {
         {
             SimplecutPassOne one(&info);
             one.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, one);
-            reader.close();
+            apply_first_pass(input, info, one, threads);
+        }
+        if (!check_cache(input)) {
+            return 1;
         }
 
         {
             SimplecutPassTwo two(&info);
             two.debug = debug;
-            osmium::io::Reader reader(infile);
-            osmium::apply(reader, two);
-            reader.close();
+            if (!apply_later_pass(input, two)) {
+                return 1;
+            }
         }
     }
 
@@ -2,7 +2,7 @@
 #define SPLITTER_SUPERSOFTERCUT_HPP
 
 #include "cut.hpp"
-#include "growing_bitset.hpp"
+#include "id_tracker.hpp"
 #include <map>
 #include <tuple>
 #include <typeinfo>
@@ -69,13 +69,13 @@ class SuperSoftercutExtractInfo : public ExtractInfo {
 
 public:
 
-    growing_bitset inside_node_tracker;	//nodes inside the box
-    growing_bitset outside_node_tracker; //nodes outside the box
+    id_tracker inside_node_tracker;	//nodes inside the box
+    id_tracker outside_node_tracker; //nodes outside the box
 
-    growing_bitset inside_way_tracker;	//ways inside the box
-    growing_bitset outside_way_tracker;	//ways outside the box
+    id_tracker inside_way_tracker;	//ways inside the box
+    id_tracker outside_way_tracker;	//ways outside the box
 
-    growing_bitset relation_tracker;	//relations
+    id_tracker relation_tracker;	//relations
 
 
     SuperSoftercutExtractInfo(const std::string& name, const osmium::io::File& file, const osmium::io::Header& header) :
@@ -90,6 +90,15 @@ public:
 
 
 class SuperSoftercutPassOne : public Cut<SuperSoftercutInfo> {
+
+    // which way nodes or relation members are inside an extract, kept to
+    // reuse the memory
+    std::vector<bool> m_hits;
+    std::vector<bool> m_way_hits;
+
+    // which of the collected way nodes are recorded as outside
+    std::vector<bool> m_outside;
+
     bool frist_node = true;
     bool frist_way = true;
     bool frist_relaction = true;
@@ -110,7 +119,7 @@ public:
     //   - walk over all bboxes
     //     - if the current node-version is inside the bbox
     //       - record its id in the bboxes inside_node_tracker
-    void node(const osmium::Node& node) {
+    void node_versions(const version_group<osmium::Node>& versions) {
         if (frist_node){
             if (debug) {
                 std::cerr << "\n==node first-pass==\n";
@@ -118,17 +127,15 @@ public:
             frist_node = false;
         }
         if (debug) {
-            std::cerr << "supersoftercut node " << node.id() << " v" << node.version() << "\n";
-        }
-        for (const auto& extract : info->extracts) {
-            if (extract->contains(node)) {
-                if (debug)
-                    std::cerr << "node is in extract, recording in node_tracker\n";
-                if(!extract->inside_node_tracker.get(node.id())){
-                    extract->inside_node_tracker.set(node.id());
-                }
+            for (const osmium::Node* node : versions) {
+                std::cerr << "supersoftercut node " << node->id() << " v" << node->version() << "\n";
             }
         }
+        for (const auto& extract : extracts_containing(versions)) {
+            if (debug)
+                std::cerr << "node is in extract, recording in node_tracker\n";
+            extract->inside_node_tracker.set(versions.id());
+        }
     }
 
     // - walk over all way-versions
@@ -137,49 +144,58 @@ public:
     //     - if node is in the box hit becames true
     //   - if hit is true and the vector is not empty (it means their are nodes that belong to a way that has at least one node inside the box - complete ways)
     //       - Records the id of node to outside_node_tracker
-    void way(const osmium::Way& way) {
+    void way_versions(const version_group<osmium::Way>& versions) {
         if (frist_way){
             if (debug) {
                 std::cerr << "\n==way first-pass==\n";
             }
             frist_way = false;
         }
-        // detect a new way
-        bool hit = false;
-
-
         if (debug) {
-            std::cerr << "supersoftercut way " << way.id() << " v" << way.version() << "\n";
+            for (const osmium::Way* way : versions) {
+                std::cerr << "supersoftercut way " << way->id() << " v" << way->version() << "\n";
+            }
         }
 
-        std::set<osmium::object_id_type> way_nodes;
+        // every node shared by several versions is only looked up once
+        collect_node_ids(versions);
 
         for (const auto& extract : info->extracts) {
-            way_nodes.clear();
-            hit = false;
-            for (const auto& node_ref : way.nodes()) {
-                if (extract->inside_node_tracker.get(node_ref.ref())) {
-                    hit = true;
-                    if (debug) {
-                        std::cerr << "way has a node (" << node_ref.ref() << ") inside extract, recording in way_tracker\n";
-                    }
-                }
-                else{
-                   way_nodes.insert(node_ref.ref());
-                }
+            if (!extract->inside_node_tracker.get_each(m_node_ids, m_hits)) {
+                continue;
             }
-            if (hit){
-                if(!extract->inside_way_tracker.get(way.id())){
-                   extract->inside_way_tracker.set(way.id());
+
+            if (debug) {
+                std::cerr << "way has a node inside extract, recording in way_tracker\n";
+            }
+            extract->inside_way_tracker.set(versions.id());
+
+            // the nodes outside of the extract are only recorded for the
+            // versions that have a node inside
+            m_outside.assign(m_node_ids.size(), false);
+            size_t first = 0;
+            for (const osmium::Way* way : versions) {
+                const size_t last = first + way->nodes().size();
+
+                bool inside = false;
+                for (size_t k = first; k < last && !inside; k++) {
+                    inside = m_hits[m_node_index[k]];
                 }
-                //Add only the nodes that were not yet in the the node-tracker if hit is true
-                if (!way_nodes.empty()){
-                    for (const auto id : way_nodes) {
-                        if(!extract->outside_node_tracker.get(id)){
-                            extract->outside_node_tracker.set(id);
+
+                if (inside) {
+                    for (size_t k = first; k < last; k++) {
+                        if (!m_hits[m_node_index[k]]) {
+                            m_outside[m_node_index[k]] = true;
                         }
                     }
                 }
+                first = last;
+            }
+
+            for (size_t i = 0; i < m_node_ids.size(); i++) {
+                if (m_outside[i]) {
+                    extract->outside_node_tracker.set(m_node_ids[i]);
+                }
             }
         }
     }
@@ -197,44 +213,37 @@ public:
             }
             frist_relaction = false;
         }
-    	bool hit = false;
-
         if (debug) {
             std::cerr << "supersoftercut relation " << relation.id() << " v" << relation.version() << "\n";
         }
 
-        std::vector<const osmium::RelationMember*> members;
-        members.reserve(relation.members().size());
-
-    	for (const auto& extract : info->extracts) {
-    		members.clear();
-            hit = false;
-    		for (const auto& member : relation.members()) {
-                if ((member.type() == osmium::item_type::node && extract->inside_node_tracker.get(member.ref())) || (member.type() == osmium::item_type::way  && extract->inside_way_tracker.get(member.ref()))) {
-                    hit = true;
-                }
-    			else if ((member.type() == osmium::item_type::node && !extract->inside_node_tracker.get(member.ref())) || (member.type() == osmium::item_type::way  && !extract->inside_way_tracker.get(member.ref()))) {
-    				members.push_back(&member);
-                }
+        for (const auto& extract : info->extracts) {
+            const bool nodes = extract->inside_node_tracker.get_each(relation.members(), osmium::item_type::node, m_hits);
+            const bool ways = extract->inside_way_tracker.get_each(relation.members(), osmium::item_type::way, m_way_hits);
+            if (!nodes && !ways) {
+                continue;
             }
-            if (hit){
-                if(!extract->relation_tracker.get(relation.id())){
-                    extract->relation_tracker.set(relation.id());
-                }
-                //Add only the nodes and ways that were not yet in the respective trackers if hit is true
-                if (!members.empty()){
-                    for (auto memptr : members) {
-                        if (memptr->type() == osmium::item_type::node && !extract->outside_node_tracker.get(memptr->ref())){
-    						extract->outside_node_tracker.set(memptr->ref());
-                        }
-                        else if (memptr->type() == osmium::item_type::way && !extract->outside_way_tracker.get(memptr->ref())){
-    						extract->outside_way_tracker.set(memptr->ref());
-                        }
-                    }
+
+            extract->relation_tracker.set(relation.id());
+
+            // record the node and way members that are not inside
+            size_t i = 0;
+            for (const auto& member : relation.members()) {
+                if (member.type() == osmium::item_type::node && !m_hits[i]) {
+                    extract->outside_node_tracker.set(member.ref());
+                } else if (member.type() == osmium::item_type::way && !m_way_hits[i]) {
+                    extract->outside_way_tracker.set(member.ref());
                 }
+                i++;
             }
         }
     }
+
+    void relation_versions(const version_group<osmium::Relation>& versions) {
+        for (const osmium::Relation* version : versions) {
+            relation(*version);
+        }
+    }
 }; // class SuperSoftercutPassOne
 
 
@@ -248,6 +257,23 @@ public:
             std::cerr << "\n\n===supersoftercut second-pass===\n\n";
         }
 
+
+        // only ways recorded as outside of an extract are looked at
+        info->way_blocks.clear();
+        for (const auto& extract : info->extracts) {
+            info->way_blocks |= extract->outside_way_tracker.summary();
+        }
+    }
+
+    // only ways and relations are looked at
+    static osmium::osm_entity_bits::type entities() {
+        return osmium::osm_entity_bits::way | osmium::osm_entity_bits::relation;
+    }
+
+    // only the blobs of the input holding a way recorded as outside are
+    // read, and all relations for their cascading pairs
+    bool wants(osmium::item_type type, osmium::object_id_type first, osmium::object_id_type last) const {
+        return type != osmium::item_type::way || info->way_blocks.any(first, last);
     }
 
     // - walk over all way-versions
@@ -264,6 +290,9 @@ public:
         if (debug) {
             std::cerr << "supersoftercut way " << way.id() << " v" << way.version() << "\n";
         }
+        if (!info->way_blocks.get(way.id())) {
+            return;
+        }
         for (const auto& extract : info->extracts) {
             if (extract->outside_way_tracker.get(way.id())) {
                 for (const auto& node_ref : way.nodes()) {
@@ -342,6 +371,34 @@ public:
             std::cerr << "\n\n===supersoftercut third-pass===\n\n";
         }
 
+
+        info->node_blocks.clear();
+        info->way_blocks.clear();
+        info->relation_blocks.clear();
+        for (const auto& extract : info->extracts) {
+            info->node_blocks |= extract->inside_node_tracker.summary();
+            info->node_blocks |= extract->outside_node_tracker.summary();
+            info->way_blocks |= extract->inside_way_tracker.summary();
+            info->way_blocks |= extract->outside_way_tracker.summary();
+            info->relation_blocks |= extract->relation_tracker.summary();
+        }
+    }
+
+    // only the blobs of the input holding a recorded object are read
+    bool wants(osmium::item_type type, osmium::object_id_type first, osmium::object_id_type last) const {
+        return info->recorded(type, first, last);
+    }
+
+    bool selects(const SuperSoftercutExtractInfo* extract, const osmium::Node& node) const {
+        return extract->inside_node_tracker.get(node.id()) || extract->outside_node_tracker.get(node.id());
+    }
+
+    bool selects(const SuperSoftercutExtractInfo* extract, const osmium::Way& way) const {
+        return extract->inside_way_tracker.get(way.id()) || extract->outside_way_tracker.get(way.id());
+    }
+
+    bool selects(const SuperSoftercutExtractInfo* extract, const osmium::Relation& relation) const {
+        return extract->relation_tracker.get(relation.id());
     }
 
     // - walk over all node-versions
@@ -352,11 +409,11 @@ public:
         if (debug) {
             std::cerr << "supersoftercut node " << node.id() << " v" << node.version() << "\n";
         }
+        if (!info->node_blocks.get(node.id())) {
+            return;
+        }
         for (const auto& extract : info->extracts) {
-            if (extract->inside_node_tracker.get(node.id())){
-                extract->write(node);
-            }
-            else if (extract->outside_node_tracker.get(node.id())) {
+            if (selects(extract, node)) {
                 extract->write(node);
             }
         }
@@ -370,11 +427,11 @@ public:
         if (debug) {
             std::cerr << "supersoftercut way " << way.id() << " v" << way.version() << "\n";
         }
+        if (!info->way_blocks.get(way.id())) {
+            return;
+        }
         for (const auto& extract : info->extracts) {
-	    if (extract->inside_way_tracker.get(way.id())){
-                extract->write(way);
-            }
-            else if (extract->outside_way_tracker.get(way.id())) {
+            if (selects(extract, way)) {
                 extract->write(way);
             }
         }
@@ -388,9 +445,12 @@ public:
         if (debug) {
             std::cerr << "supersoftercut relation " << relation.id() << " v" << relation.version() << "\n";
         }
+        if (!info->relation_blocks.get(relation.id())) {
+            return;
+        }
 
         for (const auto& extract : info->extracts) {
-            if (extract->relation_tracker.get(relation.id())){
+            if (selects(extract, relation)) {
                 extract->write(relation);
             }
         }
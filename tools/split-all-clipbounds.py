@@ -48,6 +48,12 @@ maxProcesses = 4
 # on my PC (4 GB, 4 Cores) i achived best results when doing 8 extracts
 # in parallel with 4 processes.
 
+# directory for the splitters scratch files. when set, the bit-vectors are
+# placed in sparse memory-mapped files there instead of the heap, so the os
+# pages them out instead of the splitter running out of memory and
+# maxParallel is no longer bound by your systems memory.
+scratchDir = None
+
 # the source file
 inputFile = "/home/peter/osm-data/planet-latest.osm.pbf"
 
@@ -115,7 +121,10 @@ def process(tasks):
     if(simulate):
         time.sleep(random.randint(1, 10))
     else:
-        os.spawnl(os.P_WAIT, splitterCommand, splitterCommand, "--softcut", source, configfile)
+        args = [splitterCommand, "--softcut"]
+        if scratchDir:
+            args += ["--scratch-dir", scratchDir]
+        os.spawnv(os.P_WAIT, splitterCommand, args + [source, configfile])
 
     printlock.acquire()
     print "finished splitting to", tasks
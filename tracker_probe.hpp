@@ -0,0 +1,148 @@
+#ifndef TRACKER_PROBE_HPP
+#define TRACKER_PROBE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <osmium/osm/item_type.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/types.hpp>
+#include <osmium/osm/way.hpp>
+
+/**
+ * Batched lookups of all the ids a way or relation refers to, for the
+ * id trackers. Base class of growing_bitset and compressed_bitset, which
+ * provide get(id) and prefetch(id) or a probe() of their own.
+ *
+ * The ids of a way are scattered over hundreds of MB of bitset, so every
+ * single get() is a cache miss. The batched lookups prefetch the word of
+ * an id a few ids before they look at it, so the misses overlap instead
+ * of being waited for one after the other.
+ *
+ * A tracker may replace probe() with a batched lookup that suits it
+ * better, as compressed_bitset does.
+ */
+template <typename TTracker>
+class tracker_probe {
+
+protected:
+
+    // how many ids the prefetches run ahead of the lookups
+    static const size_t distance = 8;
+
+    struct node_ref_id {
+        bool operator()(const osmium::NodeRef& node_ref, osmium::object_id_type& id) const {
+            id = node_ref.ref();
+            return true;
+        }
+    };
+
+    struct plain_id {
+        bool operator()(const osmium::object_id_type& value, osmium::object_id_type& id) const {
+            id = value;
+            return true;
+        }
+    };
+
+    struct member_id {
+        osmium::item_type type;
+
+        bool operator()(const osmium::RelationMember& member, osmium::object_id_type& id) const {
+            id = member.ref();
+            return member.type() == type;
+        }
+    };
+
+    const TTracker& tracker() const {
+        return static_cast<const TTracker&>(*this);
+    }
+
+    // look up the ids of the items in [begin, end) that ref selects. with
+    // hits set, hits[i] is set to whether the i-th item is in the tracker,
+    // otherwise the lookups stop at the first one that is. returns whether
+    // any was.
+    template <typename TIterator, typename TRef>
+    bool probe(TIterator begin, TIterator end, TRef ref, std::vector<bool>* hits) const {
+        osmium::object_id_type id;
+
+        TIterator ahead = begin;
+        for (size_t n = 0; n < distance && ahead != end; ++n, ++ahead) {
+            if (ref(*ahead, id)) {
+                tracker().prefetch(id);
+            }
+        }
+
+        if (hits) {
+            hits->clear();
+        }
+
+        bool any = false;
+        for (TIterator it = begin; it != end; ++it) {
+            if (ahead != end) {
+                if (ref(*ahead, id)) {
+                    tracker().prefetch(id);
+                }
+                ++ahead;
+            }
+
+            const bool hit = ref(*it, id) && tracker().get(id);
+            if (hits) {
+                hits->push_back(hit);
+            } else if (hit) {
+                return true;
+            }
+            any = any || hit;
+        }
+        return any;
+    }
+
+public:
+
+    /**
+     * is any node of the way in the tracker?
+     */
+    bool get_any(const osmium::WayNodeList& nodes) const {
+        return tracker().probe(nodes.begin(), nodes.end(), node_ref_id(), nullptr);
+    }
+
+    /**
+     * set hits[i] to whether the i-th node of the way is in the tracker.
+     * returns whether any is.
+     */
+    bool get_each(const osmium::WayNodeList& nodes, std::vector<bool>& hits) const {
+        return tracker().probe(nodes.begin(), nodes.end(), node_ref_id(), &hits);
+    }
+
+    /**
+     * is any of the ids in the tracker?
+     */
+    bool get_any(const std::vector<osmium::object_id_type>& ids) const {
+        return tracker().probe(ids.begin(), ids.end(), plain_id(), nullptr);
+    }
+
+    /**
+     * set hits[i] to whether ids[i] is in the tracker. returns whether
+     * any is.
+     */
+    bool get_each(const std::vector<osmium::object_id_type>& ids, std::vector<bool>& hits) const {
+        return tracker().probe(ids.begin(), ids.end(), plain_id(), &hits);
+    }
+
+    /**
+     * is any member of the given type in the tracker?
+     */
+    bool get_any(const osmium::RelationMemberList& members, osmium::item_type type) const {
+        return tracker().probe(members.begin(), members.end(), member_id { type }, nullptr);
+    }
+
+    /**
+     * set hits[i] to whether the i-th member is of the given type and in
+     * the tracker. returns whether any is.
+     */
+    bool get_each(const osmium::RelationMemberList& members, osmium::item_type type, std::vector<bool>& hits) const {
+        return tracker().probe(members.begin(), members.end(), member_id { type }, &hits);
+    }
+
+}; // class tracker_probe
+
+#endif // TRACKER_PROBE_HPP
@@ -0,0 +1,222 @@
+#ifndef SPLITTER_VERSION_GROUPER_HPP
+#define SPLITTER_VERSION_GROUPER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <osmium/io/reader.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/relation.hpp>
+#include <osmium/osm/way.hpp>
+
+#include "node_classifier.hpp"
+
+/**
+ * All versions of one object, in the order they appear in the input.
+ */
+template <typename TObject>
+class version_group {
+
+    std::vector<const TObject*> m_versions;
+
+    // the extracts containing each version, if a NodeClassifier already
+    // did the work. nodes only.
+    bool m_classified;
+    std::vector<uint32_t> m_hits;
+    std::vector<uint32_t> m_hits_end;
+
+public:
+
+    typedef typename std::vector<const TObject*>::const_iterator const_iterator;
+
+    version_group() :
+        m_versions(),
+        m_classified(false),
+        m_hits(),
+        m_hits_end() {
+    }
+
+    void add(const TObject& object) {
+        m_versions.push_back(&object);
+    }
+
+    void add(const TObject& object, const uint32_t* begin, const uint32_t* end) {
+        m_versions.push_back(&object);
+        m_classified = true;
+        m_hits.insert(m_hits.end(), begin, end);
+        m_hits_end.push_back(m_hits.size());
+    }
+
+    void clear() {
+        m_versions.clear();
+        m_classified = false;
+        m_hits.clear();
+        m_hits_end.clear();
+    }
+
+    bool empty() const {
+        return m_versions.empty();
+    }
+
+    size_t size() const {
+        return m_versions.size();
+    }
+
+    osmium::object_id_type id() const {
+        return m_versions.front()->id();
+    }
+
+    const TObject& operator[](size_t n) const {
+        return *m_versions[n];
+    }
+
+    const_iterator begin() const {
+        return m_versions.begin();
+    }
+
+    const_iterator end() const {
+        return m_versions.end();
+    }
+
+    bool classified() const {
+        return m_classified;
+    }
+
+    /**
+     * extract numbers containing the n-th version, if classified()
+     */
+    const uint32_t* hits_begin(size_t n) const {
+        return m_hits.data() + (n ? m_hits_end[n-1] : 0);
+    }
+
+    const uint32_t* hits_end(size_t n) const {
+        return m_hits.data() + m_hits_end[n];
+    }
+
+}; // class version_group
+
+/**
+ * Hands all versions of each object to a handler at once. In history
+ * files the versions of an id follow each other, and a handler that sees
+ * them together does the work common to all of them only once.
+ *
+ * The handler provides node_versions(), way_versions() and
+ * relation_versions(), each taking a version_group. Objects of other
+ * types are not passed on.
+ *
+ * The versions of an object may span several buffers of the input, the
+ * buffers are kept until the handler is done with all of them.
+ */
+template <class TCutInfo>
+class VersionGrouper {
+
+    // classifies the nodes of each buffer, nullptr to leave the nodes to
+    // the handler
+    NodeClassifier<TCutInfo>* m_classifier;
+
+    // the buffers holding versions of the pending object
+    std::vector<osmium::memory::Buffer> m_held;
+
+    // number of buffers at the front of m_held holding no pending version
+    size_t m_done;
+
+    // only one of them is not empty at a time
+    version_group<osmium::Node> m_nodes;
+    version_group<osmium::Way> m_ways;
+    version_group<osmium::Relation> m_relations;
+
+    template <class THandler>
+    void flush(THandler& handler) {
+        if (!m_nodes.empty()) {
+            handler.node_versions(m_nodes);
+            m_nodes.clear();
+        } else if (!m_ways.empty()) {
+            handler.way_versions(m_ways);
+            m_ways.clear();
+        } else if (!m_relations.empty()) {
+            handler.relation_versions(m_relations);
+            m_relations.clear();
+        }
+
+        // the buffer the next object starts in is the last one
+        m_done = m_held.size() - 1;
+    }
+
+    // pass on the pending object if object is not a version of it
+    template <typename TObject, class THandler>
+    void start(const version_group<TObject>& group, const TObject& object, THandler& handler) {
+        if (group.empty() || group.id() != object.id()) {
+            flush(handler);
+        }
+    }
+
+public:
+
+    VersionGrouper(NodeClassifier<TCutInfo>* classifier = nullptr) :
+        m_classifier(classifier),
+        m_held(),
+        m_done(0),
+        m_nodes(),
+        m_ways(),
+        m_relations() {
+    }
+
+    /**
+     * read all of reader and hand the versions of every object to handler.
+     * reader is anything with a read() returning buffers, like an
+     * osmium::io::Reader.
+     */
+    template <class TReader, class THandler>
+    void apply(TReader& reader, THandler& handler) {
+        while (osmium::memory::Buffer buffer = reader.read()) {
+            if (m_classifier) {
+                m_classifier->classify(buffer);
+            }
+            m_held.push_back(std::move(buffer));
+
+            size_t n = 0;
+            for (const auto& item : m_held.back()) {
+                switch (item.type()) {
+                    case osmium::item_type::node: {
+                        const osmium::Node& node = static_cast<const osmium::Node&>(item);
+                        start(m_nodes, node, handler);
+                        if (m_classifier) {
+                            m_nodes.add(node, m_classifier->begin(n), m_classifier->end(n));
+                        } else {
+                            m_nodes.add(node);
+                        }
+                        n++;
+                        break;
+                    }
+                    case osmium::item_type::way: {
+                        const osmium::Way& way = static_cast<const osmium::Way&>(item);
+                        start(m_ways, way, handler);
+                        m_ways.add(way);
+                        break;
+                    }
+                    case osmium::item_type::relation: {
+                        const osmium::Relation& relation = static_cast<const osmium::Relation&>(item);
+                        start(m_relations, relation, handler);
+                        m_relations.add(relation);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+
+            m_held.erase(m_held.begin(), m_held.begin() + m_done);
+            m_done = 0;
+        }
+
+        if (!m_held.empty()) {
+            flush(handler);
+        }
+        m_held.clear();
+        m_done = 0;
+    }
+
+}; // class VersionGrouper
+
+#endif // SPLITTER_VERSION_GROUPER_HPP
@@ -0,0 +1,135 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads that run the same job in parallel, once per
+ * call to run(). The calling thread takes part as worker 0, so a pool of
+ * size 1 runs everything on the calling thread.
+ */
+class worker_pool {
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    std::function<void(size_t)> m_job;
+
+    // incremented for every job, so sleeping workers notice a new one
+    size_t m_generation;
+
+    // workers still busy with the current job
+    size_t m_pending;
+
+    // first exception thrown by a worker in the current job
+    std::exception_ptr m_error;
+
+    bool m_stop;
+
+    void work(size_t worker) {
+        size_t generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&]() { return m_stop || m_generation != generation; });
+                if (m_stop) {
+                    return;
+                }
+                generation = m_generation;
+            }
+
+            execute(worker);
+        }
+    }
+
+    void execute(size_t worker) {
+        std::exception_ptr error;
+        try {
+            m_job(worker);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (error && !m_error) {
+            m_error = error;
+        }
+        if (--m_pending == 0) {
+            m_done.notify_all();
+        }
+    }
+
+public:
+
+    explicit worker_pool(size_t size) :
+        m_threads(),
+        m_mutex(),
+        m_start(),
+        m_done(),
+        m_job(),
+        m_generation(0),
+        m_pending(0),
+        m_error(),
+        m_stop(false) {
+        for (size_t worker = 1; worker < size; worker++) {
+            m_threads.emplace_back(&worker_pool::work, this, worker);
+        }
+    }
+
+    ~worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    size_t size() const {
+        return m_threads.size() + 1;
+    }
+
+    /**
+     * call job(worker) once for every worker in [0, size()) in parallel
+     * and wait for all of them. rethrows the first exception a job threw.
+     */
+    void run(const std::function<void(size_t)>& job) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = job;
+            m_pending = size();
+            m_error = nullptr;
+            m_generation++;
+        }
+        m_start.notify_all();
+
+        execute(0);
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [&]() { return m_pending == 0; });
+            error = m_error;
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+}; // class worker_pool
+
+#endif // WORKER_POOL_HPP